@@ -0,0 +1,160 @@
+#include "renderbenchmark.h"
+#include "fitz.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QRunnable>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+#include <stdio.h>
+
+/**
+ * @brief Measures one document on a pool thread.
+ */
+class BenchmarkJob : public QRunnable
+{
+public:
+    BenchmarkJob(const QString &filePath, const BenchmarkOptions &options, QJsonObject *result)
+        : m_benchmark(filePath, options)
+        , m_result(result)
+    {
+    }
+
+    void run()
+    {
+        *m_result = m_benchmark.run();
+    }
+
+private:
+    RenderBenchmark m_benchmark;
+    QJsonObject *m_result;
+};
+
+/**
+ * @brief Expand the corpus arguments: files are taken as they are,
+ * directories are searched recursively for PDF and XPS documents.
+ */
+static QStringList collectDocuments(const QStringList &arguments)
+{
+    QStringList files;
+    foreach (const QString &argument, arguments)
+    {
+        QFileInfo info(argument);
+        if (info.isDir())
+        {
+            QStringList found;
+            QDirIterator it(argument, QStringList() << "*.pdf" << "*.xps",
+                    QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext())
+                found << it.next();
+            found.sort();
+            files << found;
+        }
+        else if (info.isFile())
+        {
+            files << argument;
+        }
+        else
+        {
+            fprintf(stderr, "skipping %s: no such file or directory\n", qPrintable(argument));
+        }
+    }
+    return files;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("QMuPDFBench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Per-stage render benchmark for QMuPDFReader. "
+            "Reports wall and CPU time of page loading, display list construction, "
+            "rasterization, QImage conversion and text extraction as JSON.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("corpus", "Documents or directories to measure.", "<file|dir>...");
+    QCommandLineOption dpiOption("dpi", "Rasterization resolution (default 72).", "dpi", "72");
+    QCommandLineOption threadsOption("threads", "Documents measured in parallel (default 1).", "count", "1");
+    QCommandLineOption repeatOption("repeat", "Repetitions of every page (default 3).", "count", "3");
+    QCommandLineOption pagesOption("pages", "Measure at most this many pages per document.", "count", "0");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Write JSON to a file instead of stdout.", "file");
+    parser.addOption(dpiOption);
+    parser.addOption(threadsOption);
+    parser.addOption(repeatOption);
+    parser.addOption(pagesOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    QStringList files = collectDocuments(parser.positionalArguments());
+    if (files.isEmpty())
+    {
+        parser.showHelp(1);
+    }
+
+    BenchmarkOptions options;
+    options.dpi = parser.value(dpiOption).toFloat();
+    options.repeat = parser.value(repeatOption).toInt();
+    options.maxPages = parser.value(pagesOption).toInt();
+    int threads = qMax(1, parser.value(threadsOption).toInt());
+    if (options.dpi <= 0.0f)
+    {
+        fprintf(stderr, "invalid --dpi value\n");
+        return 1;
+    }
+
+    QVector<QJsonObject> results(files.size());
+    QElapsedTimer timer;
+    timer.start();
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    for (int i = 0; i < files.size(); ++i)
+    {
+        pool.start(new BenchmarkJob(files.at(i), options, &results[i]));
+    }
+    pool.waitForDone();
+
+    QJsonArray documents;
+    foreach (const QJsonObject &result, results)
+    {
+        documents.append(result);
+    }
+
+    QJsonObject settings;
+    settings.insert("dpi", options.dpi);
+    settings.insert("threads", threads);
+    settings.insert("repeat", options.repeat);
+    settings.insert("pages", options.maxPages);
+
+    QJsonObject report;
+    report.insert("mupdf_version", QString(FZ_VERSION));
+    report.insert("options", settings);
+    report.insert("wall_ms", timer.nsecsElapsed() / 1000000.0);
+    report.insert("peak_rss_bytes", peakResidentBytes());
+    report.insert("documents", documents);
+
+    QByteArray json = QJsonDocument(report).toJson();
+    if (parser.isSet(outputOption))
+    {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            fprintf(stderr, "cannot write %s\n", qPrintable(file.fileName()));
+            return 1;
+        }
+        file.write(json);
+    }
+    else
+    {
+        fwrite(json.constData(), 1, json.size(), stdout);
+    }
+    return 0;
+}
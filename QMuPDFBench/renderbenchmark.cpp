@@ -0,0 +1,441 @@
+#include "renderbenchmark.h"
+#include "fitz.h"
+
+#include <QFileInfo>
+#include <QImage>
+#include <QJsonArray>
+#include <QVector>
+
+#include <algorithm>
+#include <chrono>
+#include <stdlib.h>
+
+#ifdef Q_OS_WIN
+// keep std::max usable
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+namespace
+{
+
+enum Stage
+{
+    StageLoadPage = 0,
+    StageDisplayList,
+    StageRasterize,
+    StageQImage,
+    StageStext,
+    StageCount
+};
+
+const char *const stageNames[StageCount] =
+{
+    "load_page",
+    "display_list",
+    "rasterize",
+    "qimage",
+    "stext"
+};
+
+/**
+ * @brief One measurement of one stage, in nanoseconds.
+ */
+struct StageSample
+{
+    qint64 wall;
+    qint64 cpu;
+};
+
+/**
+ * @brief Bytes handed out by the allocator of one fz_context.
+ */
+struct AllocStats
+{
+    size_t current;
+    size_t peak;
+};
+
+// keeps the returned blocks aligned for any type
+const size_t allocHeader = 16;
+
+void *countingMalloc(void *user, size_t size)
+{
+    AllocStats *stats = static_cast<AllocStats *>(user);
+    unsigned char *block = static_cast<unsigned char *>(malloc(size + allocHeader));
+    if (!block)
+        return NULL;
+    *reinterpret_cast<size_t *>(block) = size;
+    stats->current += size;
+    stats->peak = std::max(stats->peak, stats->current);
+    return block + allocHeader;
+}
+
+void countingFree(void *user, void *ptr)
+{
+    if (!ptr)
+        return;
+    AllocStats *stats = static_cast<AllocStats *>(user);
+    unsigned char *block = static_cast<unsigned char *>(ptr) - allocHeader;
+    stats->current -= *reinterpret_cast<size_t *>(block);
+    free(block);
+}
+
+void *countingRealloc(void *user, void *ptr, size_t size)
+{
+    if (!ptr)
+        return countingMalloc(user, size);
+    if (size == 0)
+    {
+        countingFree(user, ptr);
+        return NULL;
+    }
+    AllocStats *stats = static_cast<AllocStats *>(user);
+    unsigned char *block = static_cast<unsigned char *>(ptr) - allocHeader;
+    size_t oldSize = *reinterpret_cast<size_t *>(block);
+    block = static_cast<unsigned char *>(realloc(block, size + allocHeader));
+    if (!block)
+        return NULL;
+    *reinterpret_cast<size_t *>(block) = size;
+    stats->current = stats->current - oldSize + size;
+    stats->peak = std::max(stats->peak, stats->current);
+    return block + allocHeader;
+}
+
+/**
+ * @brief Monotonic wall clock; stateless, so any pool thread may call it.
+ */
+qint64 wallTimeNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief CPU time consumed by the calling thread.
+ */
+qint64 threadCpuTimeNs()
+{
+#ifdef Q_OS_WIN
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0;
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    // FILETIME counts 100ns intervals
+    return static_cast<qint64>(k.QuadPart + u.QuadPart) * 100;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<qint64>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+inline void beginSample(StageSample *sample)
+{
+    sample->wall = wallTimeNs();
+    sample->cpu = threadCpuTimeNs();
+}
+
+inline void endSample(StageSample *sample)
+{
+    sample->cpu = threadCpuTimeNs() - sample->cpu;
+    sample->wall = wallTimeNs() - sample->wall;
+}
+
+/**
+ * @brief What QPainter::drawImage() pays before blitting @p image onto
+ * a raster paint device; nothing for the formats the viewer renders to.
+ */
+QImage paintableImage(const QImage &image)
+{
+    if (image.format() == QImage::Format_RGB32
+            || image.format() == QImage::Format_ARGB32_Premultiplied)
+        return image;
+    return image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+}
+
+/**
+ * @brief Run every stage once for one page.
+ *
+ * @return false if MuPDF raised an error, with the message in @p error.
+ */
+bool runPage(fz_context *ctx, fz_document *doc, int index,
+        const fz_matrix *transform, StageSample *samples, QString *error)
+{
+    QImage image;
+    fz_page *page = NULL;
+    fz_display_list *list = NULL;
+    fz_pixmap *pixmap = NULL;
+    fz_device *dev = NULL;
+    fz_stext_page *text_page = NULL;
+    fz_rect mediabox;
+    fz_rect bounds;
+    fz_irect bbox;
+    bool ok = true;
+
+    fz_var(page);
+    fz_var(list);
+    fz_var(pixmap);
+    fz_var(dev);
+    fz_var(text_page);
+    fz_var(ok);
+
+    fz_try(ctx)
+    {
+        beginSample(&samples[StageLoadPage]);
+        page = fz_load_page(ctx, doc, index);
+        fz_bound_page(ctx, page, &mediabox);
+        endSample(&samples[StageLoadPage]);
+
+        beginSample(&samples[StageDisplayList]);
+        list = fz_new_display_list(ctx, NULL);
+        dev = fz_new_list_device(ctx, list);
+        fz_run_page_contents(ctx, page, dev, &fz_identity, NULL);
+        fz_close_device(ctx, dev);
+        fz_drop_device(ctx, dev);
+        dev = NULL;
+        endSample(&samples[StageDisplayList]);
+
+        beginSample(&samples[StageRasterize]);
+        bounds = mediabox;
+        fz_round_rect(&bbox, fz_transform_rect(&bounds, transform));
+        fz_rect_from_irect(&bounds, &bbox);
+        // same as MuPDF::Page::renderRegion(): draw into the QImage buffer
+        image = QImage(bbox.x1 - bbox.x0, bbox.y1 - bbox.y0, QImage::Format_RGB32);
+        if (image.isNull())
+            fz_throw(ctx, FZ_ERROR_GENERIC, "cannot allocate image");
+        image.fill(0xffffffff);
+        pixmap = fz_new_pixmap_with_bbox_and_data(ctx, fz_device_bgr(ctx), &bbox, NULL, 1, image.bits());
+        dev = fz_new_draw_device(ctx, NULL, pixmap);
+        fz_run_display_list(ctx, list, dev, transform, &bounds, NULL);
+        fz_close_device(ctx, dev);
+        fz_drop_device(ctx, dev);
+        dev = NULL;
+        endSample(&samples[StageRasterize]);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
+        dev = NULL;
+    }
+    fz_catch(ctx)
+    {
+        *error = QString::fromUtf8(fz_caught_message(ctx));
+        ok = false;
+    }
+
+    if (ok)
+    {
+        beginSample(&samples[StageQImage]);
+        {
+            QImage paintable = paintableImage(image);
+            Q_UNUSED(paintable)
+        }
+        endSample(&samples[StageQImage]);
+
+        fz_try(ctx)
+        {
+            beginSample(&samples[StageStext]);
+            text_page = fz_new_stext_page(ctx, &mediabox);
+            dev = fz_new_stext_device(ctx, text_page, NULL);
+            fz_run_display_list(ctx, list, dev, &fz_identity, &fz_infinite_rect, NULL);
+            fz_close_device(ctx, dev);
+            fz_drop_device(ctx, dev);
+            dev = NULL;
+            endSample(&samples[StageStext]);
+        }
+        fz_always(ctx)
+        {
+            fz_drop_device(ctx, dev);
+            fz_drop_stext_page(ctx, text_page);
+        }
+        fz_catch(ctx)
+        {
+            *error = QString::fromUtf8(fz_caught_message(ctx));
+            ok = false;
+        }
+    }
+
+    fz_drop_pixmap(ctx, pixmap);
+    fz_drop_display_list(ctx, list);
+    fz_drop_page(ctx, page);
+    return ok;
+}
+
+double toMs(qint64 ns)
+{
+    return ns / 1000000.0;
+}
+
+qint64 median(QVector<qint64> values)
+{
+    if (values.isEmpty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    return values.at(values.size() / 2);
+}
+
+} // end anonymous namespace
+
+RenderBenchmark::RenderBenchmark(const QString &filePath, const BenchmarkOptions &options)
+    : m_filePath(filePath)
+    , m_options(options)
+{
+}
+
+/**
+ * @brief Measure the document.
+ *
+ * Every stage is reported as the median over all repetitions; "cold_ms"
+ * is the first repetition, before MuPDF's store is warm.
+ *
+ * "store_bytes" is what fz_empty_store() releases once all pages have been
+ * measured, i.e. the fonts, images and other resources MuPDF kept cached.
+ */
+QJsonObject RenderBenchmark::run()
+{
+    QJsonObject result;
+    result.insert("file", QFileInfo(m_filePath).absoluteFilePath());
+    result.insert("size_bytes", QFileInfo(m_filePath).size());
+
+    AllocStats stats = { 0, 0 };
+    fz_alloc_context alloc = { &stats, countingMalloc, countingRealloc, countingFree };
+    fz_context *ctx = fz_new_context(&alloc, NULL, FZ_STORE_UNLIMITED);
+    if (!ctx)
+    {
+        result.insert("error", QString("cannot create context"));
+        return result;
+    }
+    fz_register_document_handlers(ctx);
+
+    fz_document *doc = NULL;
+    int pageCount = 0;
+    qint64 openStart = wallTimeNs();
+    fz_try(ctx)
+    {
+        doc = fz_open_document(ctx, m_filePath.toUtf8().data());
+        pageCount = fz_count_pages(ctx, doc);
+    }
+    fz_catch(ctx)
+    {
+        pageCount = -1;
+    }
+    qint64 openTime = wallTimeNs() - openStart;
+
+    if (pageCount < 0 || fz_needs_password(ctx, doc))
+    {
+        result.insert("error", pageCount < 0
+                ? QString::fromUtf8(fz_caught_message(ctx))
+                : QString("document needs a password"));
+        fz_drop_document(ctx, doc);
+        fz_drop_context(ctx);
+        return result;
+    }
+    result.insert("open_ms", toMs(openTime));
+    result.insert("pages", pageCount);
+    if (m_options.maxPages > 0)
+        pageCount = qMin(pageCount, m_options.maxPages);
+
+    fz_matrix transform;
+    fz_scale(&transform, m_options.dpi / 72.0f, m_options.dpi / 72.0f);
+
+    const int repeat = qMax(1, m_options.repeat);
+    QVector<qint64> totalWall(StageCount, 0);
+    QVector<qint64> totalCpu(StageCount, 0);
+    QJsonArray pages;
+
+    for (int index = 0; index < pageCount; ++index)
+    {
+        QVector<qint64> wall[StageCount];
+        QVector<qint64> cpu[StageCount];
+        QJsonObject pageResult;
+        pageResult.insert("page", index);
+
+        for (int rep = 0; rep < repeat; ++rep)
+        {
+            StageSample samples[StageCount];
+            memset(samples, 0, sizeof(samples));
+            QString error;
+            if (!runPage(ctx, doc, index, &transform, samples, &error))
+            {
+                pageResult.insert("error", error);
+                break;
+            }
+            for (int stage = 0; stage < StageCount; ++stage)
+            {
+                wall[stage].append(samples[stage].wall);
+                cpu[stage].append(samples[stage].cpu);
+            }
+        }
+
+        QJsonObject stages;
+        for (int stage = 0; stage < StageCount; ++stage)
+        {
+            if (wall[stage].isEmpty())
+                continue;
+            QJsonObject timing;
+            qint64 wallMedian = median(wall[stage]);
+            qint64 cpuMedian = median(cpu[stage]);
+            timing.insert("wall_ms", toMs(wallMedian));
+            timing.insert("wall_min_ms", toMs(*std::min_element(wall[stage].begin(), wall[stage].end())));
+            timing.insert("cpu_ms", toMs(cpuMedian));
+            timing.insert("cold_ms", toMs(wall[stage].first()));
+            stages.insert(stageNames[stage], timing);
+            totalWall[stage] += wallMedian;
+            totalCpu[stage] += cpuMedian;
+        }
+        pageResult.insert("stages", stages);
+        pages.append(pageResult);
+    }
+
+    QJsonObject totals;
+    for (int stage = 0; stage < StageCount; ++stage)
+    {
+        QJsonObject timing;
+        timing.insert("wall_ms", toMs(totalWall[stage]));
+        timing.insert("cpu_ms", toMs(totalCpu[stage]));
+        totals.insert(stageNames[stage], timing);
+    }
+    result.insert("totals", totals);
+    result.insert("page_results", pages);
+
+    size_t beforeEmpty = stats.current;
+    fz_empty_store(ctx);
+    result.insert("store_bytes", static_cast<qint64>(beforeEmpty - stats.current));
+    result.insert("heap_peak_bytes", static_cast<qint64>(stats.peak));
+
+    fz_drop_document(ctx, doc);
+    fz_drop_context(ctx);
+    return result;
+}
+
+/**
+ * @brief Peak resident set size of the whole process.
+ */
+qint64 peakResidentBytes()
+{
+#ifdef Q_OS_WIN
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return static_cast<qint64>(counters.PeakWorkingSetSize);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef Q_OS_MACOS
+    return usage.ru_maxrss;
+#else
+    // Linux reports kilobytes
+    return static_cast<qint64>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
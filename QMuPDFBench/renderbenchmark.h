@@ -0,0 +1,50 @@
+#ifndef RENDER_BENCHMARK_H
+#define RENDER_BENCHMARK_H
+
+#include <QJsonObject>
+#include <QString>
+
+/**
+ * @brief Settings shared by every document of a benchmark run.
+ */
+struct BenchmarkOptions
+{
+    BenchmarkOptions()
+        : dpi(72.0f), repeat(3), maxPages(0)
+    {
+    }
+
+    float dpi;      // rasterization resolution
+    int repeat;     // samples taken for every page and stage
+    int maxPages;   // 0 means all pages
+};
+
+/**
+ * @brief Measures one document, stage by stage.
+ *
+ * The stages mirror what MuPDF::Page does for the viewer:
+ *  - load_page:    fz_load_page
+ *  - display_list: recording fz_run_page_contents into a display list
+ *  - rasterize:    fz_run_display_list into the draw device
+ *  - qimage:       converting the rendered QImage to a format QPainter can
+ *                  blit (free when rendering straight into RGB32)
+ *  - stext:        structured text extraction from the display list
+ *
+ * Each document uses its own fz_context with a counting allocator, so
+ * several documents can be measured on different threads at once.
+ */
+class RenderBenchmark
+{
+public:
+    RenderBenchmark(const QString &filePath, const BenchmarkOptions &options);
+
+    QJsonObject run();
+
+private:
+    QString m_filePath;
+    BenchmarkOptions m_options;
+};
+
+qint64 peakResidentBytes();
+
+#endif // RENDER_BENCHMARK_H
@@ -0,0 +1,248 @@
+#include "pdfoptimizer.h"
+#include "fitz.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QPair>
+#include <QRunnable>
+#include <QStringList>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#include <stdio.h>
+
+/**
+ * @brief Optimizes one document on a pool thread.
+ */
+class OptimizeJob : public QRunnable
+{
+public:
+    OptimizeJob(const QString &inputPath, const QString &outputPath, const OptimizeOptions &options,
+                QJsonObject *result)
+        : m_optimizer(inputPath, outputPath, options)
+        , m_result(result)
+    {
+    }
+
+    void run()
+    {
+        *m_result = m_optimizer.run();
+    }
+
+private:
+    PdfOptimizer m_optimizer;
+    QJsonObject *m_result;
+};
+
+/**
+ * @brief Expand the input arguments into (file, output name) pairs:
+ * files keep their name, directories are searched recursively for PDF
+ * documents, which keep their path relative to the directory.
+ */
+static QList<QPair<QString, QString> > collectDocuments(const QStringList &arguments)
+{
+    QList<QPair<QString, QString> > files;
+    foreach (const QString &argument, arguments)
+    {
+        QFileInfo info(argument);
+        if (info.isDir())
+        {
+            QDir dir(argument);
+            QStringList found;
+            QDirIterator it(argument, QStringList() << "*.pdf", QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext())
+                found << it.next();
+            found.sort();
+            foreach (const QString &file, found)
+                files << qMakePair(file, dir.relativeFilePath(file));
+        }
+        else if (info.isFile())
+        {
+            files << qMakePair(argument, info.fileName());
+        }
+        else
+        {
+            fprintf(stderr, "skipping %s: no such file or directory\n", qPrintable(argument));
+        }
+    }
+    return files;
+}
+
+/**
+ * @brief @p path made comparable: symbolic links resolved as far as the
+ * path exists, case folded where the file system ignores case.
+ */
+static QString comparablePath(const QString &path)
+{
+    QFileInfo info(path);
+    QString result;
+    if (info.exists())
+    {
+        result = info.canonicalFilePath();
+    }
+    else
+    {
+        const QString dir = QFileInfo(info.absolutePath()).canonicalFilePath();
+        result = dir.isEmpty() ? QDir::cleanPath(info.absoluteFilePath()) : dir + '/' + info.fileName();
+    }
+#ifdef Q_OS_WIN
+    result = result.toLower();
+#endif
+    return result;
+}
+
+/**
+ * @brief Result entry of a document that is not optimized.
+ */
+static QJsonObject skipped(const QString &inputPath, const QString &outputPath, const QString &error)
+{
+    QJsonObject result;
+    result.insert("file", QFileInfo(inputPath).absoluteFilePath());
+    result.insert("output", QFileInfo(outputPath).absoluteFilePath());
+    result.insert("error", error);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("QMuPDFOptimize");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Rewrites PDF documents with garbage collection, deduplication, "
+            "compression and linearization, so QMuPDFReader opens them faster. "
+            "Reports size and open time before and after as JSON.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("input", "Documents or directories to optimize.", "<file|dir>...");
+    QCommandLineOption outputDirOption(QStringList() << "d" << "output-dir", "Directory for the optimized documents.", "dir");
+    QCommandLineOption garbageOption("garbage", "0 none, 1 collect, 2 renumber, 3 deduplicate (default 3).", "level", "3");
+    QCommandLineOption noCompressOption("no-compress", "Leave uncompressed streams as they are.");
+    QCommandLineOption noLinearizeOption("no-linearize", "Do not linearize the output.");
+    QCommandLineOption threadsOption("threads", "Documents optimized in parallel (default: all cores).", "count",
+            QString::number(QThread::idealThreadCount()));
+    QCommandLineOption repeatOption("repeat", "Open time samples per document (default 3).", "count", "3");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Write JSON to a file instead of stdout.", "file");
+    parser.addOption(outputDirOption);
+    parser.addOption(garbageOption);
+    parser.addOption(noCompressOption);
+    parser.addOption(noLinearizeOption);
+    parser.addOption(threadsOption);
+    parser.addOption(repeatOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    QList<QPair<QString, QString> > files = collectDocuments(parser.positionalArguments());
+    if (files.isEmpty() || !parser.isSet(outputDirOption))
+    {
+        parser.showHelp(1);
+    }
+
+    OptimizeOptions options;
+    options.garbage = parser.value(garbageOption).toInt();
+    options.compress = !parser.isSet(noCompressOption);
+    options.compressImages = options.compress;
+    options.compressFonts = options.compress;
+    options.linearize = !parser.isSet(noLinearizeOption);
+    options.repeat = parser.value(repeatOption).toInt();
+    int threads = qMax(1, parser.value(threadsOption).toInt());
+    if (options.garbage < 0 || options.garbage > 3)
+    {
+        fprintf(stderr, "invalid --garbage value\n");
+        return 1;
+    }
+
+    QDir outputDir(parser.value(outputDirOption));
+    QVector<QJsonObject> results(files.size());
+
+    // an output must neither replace its input nor be shared by two
+    // inputs, e.g. equal file names from different directories
+    QStringList outputPaths;
+    QHash<QString, int> outputUses;
+    for (int i = 0; i < files.size(); ++i)
+    {
+        outputPaths << outputDir.filePath(files.at(i).second);
+        ++outputUses[comparablePath(outputPaths.at(i))];
+    }
+    QVector<bool> runnable(files.size(), false);
+    for (int i = 0; i < files.size(); ++i)
+    {
+        const QString inputPath = files.at(i).first;
+        const QString output = comparablePath(outputPaths.at(i));
+        if (output == comparablePath(inputPath))
+        {
+            results[i] = skipped(inputPath, outputPaths.at(i), "output would overwrite the input");
+        }
+        else if (outputUses.value(output) > 1)
+        {
+            results[i] = skipped(inputPath, outputPaths.at(i), "output name used by more than one input");
+        }
+        else
+        {
+            runnable[i] = true;
+            continue;
+        }
+        fprintf(stderr, "skipping %s: %s\n", qPrintable(inputPath),
+                qPrintable(results.at(i).value("error").toString()));
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    for (int i = 0; i < files.size(); ++i)
+    {
+        if (runnable.at(i))
+            pool.start(new OptimizeJob(files.at(i).first, outputPaths.at(i), options, &results[i]));
+    }
+    pool.waitForDone();
+
+    QJsonArray documents;
+    int failed = 0;
+    foreach (const QJsonObject &result, results)
+    {
+        documents.append(result);
+        if (result.contains("error"))
+            ++failed;
+    }
+
+    QJsonObject settings;
+    settings.insert("garbage", options.garbage);
+    settings.insert("compress", options.compress);
+    settings.insert("linearize", options.linearize);
+    settings.insert("threads", threads);
+    settings.insert("repeat", options.repeat);
+
+    QJsonObject report;
+    report.insert("mupdf_version", QString(FZ_VERSION));
+    report.insert("options", settings);
+    report.insert("wall_ms", timer.nsecsElapsed() / 1000000.0);
+    report.insert("failed", failed);
+    report.insert("documents", documents);
+
+    QByteArray json = QJsonDocument(report).toJson();
+    if (parser.isSet(outputOption))
+    {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            fprintf(stderr, "cannot write %s\n", qPrintable(file.fileName()));
+            return 1;
+        }
+        file.write(json);
+    }
+    else
+    {
+        fwrite(json.constData(), 1, json.size(), stdout);
+    }
+    return failed ? 2 : 0;
+}
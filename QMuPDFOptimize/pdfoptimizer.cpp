@@ -0,0 +1,208 @@
+#include "pdfoptimizer.h"
+#include "fitz.h"
+#include "pdf.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QVector>
+
+#include <algorithm>
+
+namespace
+{
+
+double toMs(qint64 ns)
+{
+    return ns / 1000000.0;
+}
+
+qint64 median(QVector<qint64> values)
+{
+    if (values.isEmpty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    return values.at(values.size() / 2);
+}
+
+/**
+ * @brief Time until the first page of @p filePath is loaded, with a cold
+ * context.
+ *
+ * @return nanoseconds, or -1 with the message in @p error
+ */
+qint64 openTime(const QString &filePath, int *pageCount, QString *error)
+{
+    fz_context *ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+    if (!ctx)
+    {
+        *error = QString("cannot create context");
+        return -1;
+    }
+    fz_register_document_handlers(ctx);
+
+    fz_document *doc = NULL;
+    fz_page *page = NULL;
+    qint64 time = -1;
+    fz_var(doc);
+    fz_var(page);
+    fz_var(time);
+
+    QElapsedTimer timer;
+    timer.start();
+    fz_try(ctx)
+    {
+        doc = fz_open_document(ctx, filePath.toUtf8().data());
+        if (fz_needs_password(ctx, doc))
+            fz_throw(ctx, FZ_ERROR_GENERIC, "document needs a password");
+        *pageCount = fz_count_pages(ctx, doc);
+        if (*pageCount > 0)
+            page = fz_load_page(ctx, doc, 0);
+        time = timer.nsecsElapsed();
+    }
+    fz_always(ctx)
+    {
+        fz_drop_page(ctx, page);
+        fz_drop_document(ctx, doc);
+    }
+    fz_catch(ctx)
+    {
+        *error = QString::fromUtf8(fz_caught_message(ctx));
+        time = -1;
+    }
+    fz_drop_context(ctx);
+    return time;
+}
+
+/**
+ * @brief Median open time over @p repeat cold opens.
+ */
+bool measure(const QString &filePath, int repeat, QJsonObject *result, QString *error)
+{
+    QVector<qint64> samples;
+    int pageCount = 0;
+    for (int i = 0; i < qMax(1, repeat); ++i)
+    {
+        const qint64 time = openTime(filePath, &pageCount, error);
+        if (time < 0)
+            return false;
+        samples.append(time);
+    }
+    result->insert("size_bytes", QFileInfo(filePath).size());
+    result->insert("open_ms", toMs(median(samples)));
+    result->insert("pages", pageCount);
+    return true;
+}
+
+/**
+ * @brief Write @p inputPath with @p options to @p outputPath.
+ */
+bool optimize(const QString &inputPath, const QString &outputPath, const OptimizeOptions &options,
+              QString *error)
+{
+    fz_context *ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+    if (!ctx)
+    {
+        *error = QString("cannot create context");
+        return false;
+    }
+    fz_register_document_handlers(ctx);
+
+    pdf_write_options opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.do_garbage = qBound(0, options.garbage, 3);
+    opts.do_compress = options.compress ? 1 : 0;
+    opts.do_compress_images = options.compressImages ? 1 : 0;
+    opts.do_compress_fonts = options.compressFonts ? 1 : 0;
+    opts.do_linear = options.linearize ? 1 : 0;
+
+    fz_document *doc = NULL;
+    bool ok = true;
+    fz_var(doc);
+    fz_try(ctx)
+    {
+        doc = fz_open_document(ctx, inputPath.toUtf8().data());
+        if (fz_needs_password(ctx, doc))
+            fz_throw(ctx, FZ_ERROR_GENERIC, "document needs a password");
+        pdf_document *pdf = pdf_specifics(ctx, doc);
+        if (!pdf)
+            fz_throw(ctx, FZ_ERROR_GENERIC, "not a PDF document");
+        pdf_save_document(ctx, pdf, outputPath.toUtf8().data(), &opts);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_document(ctx, doc);
+    }
+    fz_catch(ctx)
+    {
+        *error = QString::fromUtf8(fz_caught_message(ctx));
+        ok = false;
+    }
+    fz_drop_context(ctx);
+    return ok;
+}
+
+} // end anonymous namespace
+
+PdfOptimizer::PdfOptimizer(const QString &inputPath, const QString &outputPath,
+                           const OptimizeOptions &options)
+    : m_inputPath(inputPath)
+    , m_outputPath(outputPath)
+    , m_options(options)
+{
+}
+
+/**
+ * @brief Optimize the document.
+ *
+ * "before" and "after" hold the file size, the page count and the median
+ * open time; "write_ms" is the time taken to rewrite the file.
+ */
+QJsonObject PdfOptimizer::run()
+{
+    QJsonObject result;
+    result.insert("file", QFileInfo(m_inputPath).absoluteFilePath());
+    result.insert("output", QFileInfo(m_outputPath).absoluteFilePath());
+
+    QString error;
+    QJsonObject before;
+    if (!measure(m_inputPath, m_options.repeat, &before, &error))
+    {
+        result.insert("error", error);
+        return result;
+    }
+    result.insert("before", before);
+
+    QDir().mkpath(QFileInfo(m_outputPath).absolutePath());
+    const QString partPath = m_outputPath + ".part";
+    QElapsedTimer timer;
+    timer.start();
+    if (!optimize(m_inputPath, partPath, m_options, &error))
+    {
+        QFile::remove(partPath);
+        result.insert("error", error);
+        return result;
+    }
+    result.insert("write_ms", toMs(timer.nsecsElapsed()));
+    QFile::remove(m_outputPath);
+    if (!QFile::rename(partPath, m_outputPath))
+    {
+        QFile::remove(partPath);
+        result.insert("error", QString("cannot write %1").arg(m_outputPath));
+        return result;
+    }
+
+    QJsonObject after;
+    if (!measure(m_outputPath, m_options.repeat, &after, &error))
+    {
+        result.insert("error", error);
+        return result;
+    }
+    result.insert("after", after);
+    if (before.value("size_bytes").toDouble() > 0)
+    {
+        result.insert("size_ratio", after.value("size_bytes").toDouble() / before.value("size_bytes").toDouble());
+    }
+    return result;
+}
@@ -0,0 +1,51 @@
+#ifndef PDF_OPTIMIZER_H
+#define PDF_OPTIMIZER_H
+
+#include <QJsonObject>
+#include <QString>
+
+/**
+ * @brief pdf_write_options used for every document of a run.
+ */
+struct OptimizeOptions
+{
+    OptimizeOptions()
+        : garbage(3), compress(true), compressImages(true), compressFonts(true)
+        , linearize(true), repeat(3)
+    {
+    }
+
+    int garbage;            // do_garbage: 1 collect, 2 renumber, 3 deduplicate
+    bool compress;          // do_compress
+    bool compressImages;    // do_compress_images
+    bool compressFonts;     // do_compress_fonts
+    bool linearize;         // do_linear, for progressive opening
+    int repeat;             // samples of the open time
+};
+
+/**
+ * @brief Rewrites one PDF with MuPDF's cleanup options and measures it
+ * before and after.
+ *
+ * The open time is what a viewer waits before it can show the first
+ * page: fz_open_document, fz_count_pages and fz_load_page of page 0,
+ * each sample with a fresh fz_context so nothing is cached. The output
+ * is written next to its final name and renamed once complete.
+ *
+ * Each document uses its own fz_context, so several documents can be
+ * optimized on different threads at once.
+ */
+class PdfOptimizer
+{
+public:
+    PdfOptimizer(const QString &inputPath, const QString &outputPath, const OptimizeOptions &options);
+
+    QJsonObject run();
+
+private:
+    QString m_inputPath;
+    QString m_outputPath;
+    OptimizeOptions m_options;
+};
+
+#endif // PDF_OPTIMIZER_H
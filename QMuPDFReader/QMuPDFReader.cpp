@@ -1,9 +1,17 @@
 #include "QMuPDFReader.h"
+#include "printjob.h"
+#include "savejob.h"
+#include "exportjob.h"
+#include "pagerender.h"
+#include <QEventLoop>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QMessageBox>
 #include <QScrollBar>
-#include <QPainter>
+#include <QShortcut>
+#include <QPrintDialog>
 #include <QPrinter>
+#include <QProgressDialog>
 #include <QRegExpValidator>
 
 QMuPDFReader::QMuPDFReader(QWidget *parent)
@@ -33,6 +41,28 @@ QMuPDFReader::QMuPDFReader(QWidget *parent)
 	connect(ui.pushButton_printer, &QPushButton::clicked, this, &QMuPDFReader::sltPrinterPDF);
 	connect(ui.pushButton_goToPage, &QPushButton::clicked, this, &QMuPDFReader::sltGoToPage);
 	connect(ui.pdfPages, &SequentialPageWidget::updatePdfInfo, this, &QMuPDFReader::sltUpdateInfo);
+	//ĵתĿλ
+	connect(ui.pdfPages, &SequentialPageWidget::scrollRequested, ui.scrollArea->verticalScrollBar(), &QScrollBar::setValue);
+
+	//ͼͼȾ߳(ȼ)ǰҳ
+	ui.thumbnailView->thumbnailModel()->setPageRender(ui.pdfPages->pageRender());
+	connect(ui.pdfPages, &SequentialPageWidget::updatePdfInfo, ui.thumbnailView, &ThumbnailView::setCurrentPage);
+	connect(ui.thumbnailView, &ThumbnailView::pageActivated, this, &QMuPDFReader::sltThumbnailClicked);
+
+	//Ctrl+Iлҹģʽ(ɫ)
+	QShortcut *nightMode = new QShortcut(QKeySequence(Qt::CTRL + Qt::Key_I), this);
+	connect(nightMode, &QShortcut::activated, this, &QMuPDFReader::sltNightMode);
+	//Ctrl+Shift+Aʾ/ע(ע͵ɲ㣬Ⱦҳ)
+	QShortcut *annotations = new QShortcut(QKeySequence(Qt::CTRL + Qt::SHIFT + Qt::Key_A), this);
+	connect(annotations, &QShortcut::activated, this, &QMuPDFReader::sltToggleAnnotations);
+	//Ctrl+S棬Ctrl+Shift+SΪ
+	QShortcut *save = new QShortcut(QKeySequence(Qt::CTRL + Qt::Key_S), this);
+	connect(save, &QShortcut::activated, this, &QMuPDFReader::sltSavePDF);
+	QShortcut *saveAs = new QShortcut(QKeySequence(Qt::CTRL + Qt::SHIFT + Qt::Key_S), this);
+	connect(saveAs, &QShortcut::activated, this, &QMuPDFReader::sltSavePDFAs);
+	//Ctrl+Eȫ(ı/HTML/XHTML/XML)
+	QShortcut *exportText = new QShortcut(QKeySequence(Qt::CTRL + Qt::Key_E), this);
+	connect(exportText, &QShortcut::activated, this, &QMuPDFReader::sltExportText);
 }
 
 QMuPDFReader::~QMuPDFReader()
@@ -54,6 +84,7 @@ void QMuPDFReader::sltOpenPDF()
 		return;
 	}
 	ui.label_pdfFileName->setText(file.split("/").last());
+	ui.thumbnailView->thumbnailModel()->setPageCount(ui.pdfPages->document()->numPages());
 }
 
 void QMuPDFReader::sltPreviousPage()
@@ -82,29 +113,191 @@ void QMuPDFReader::sltZoomOut()
 
 void QMuPDFReader::sltPrinterPDF()
 {
+	MuPDF::Document *document = ui.pdfPages->document();
+	if (!document){
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ȴPDFļ"));
+		return;
+	}
+	int totalPages = document->numPages();
+
 	QPrinter printer(QPrinter::HighResolution);
 	//printer.setOrientation(QPrinter::Portrait);
 	printer.setOutputFormat(QPrinter::NativeFormat);
 	printer.setFullPage(true);
 	printer.setPageSize(QPageSize(QPageSize::A4));
-	//ͼƬ
-	QImage img;
-	QPainter painter(&printer);
-	for (int index = 0; index < 1; index++)
-	{
-		img = ui.pdfPages->getPDFImage(index);
-		//painter.drawImage(0,0,img);
-		//painter.end();
-		QRect rect = painter.viewport();
-		QSize size = img.size();
-		size.scale(rect.size(), Qt::KeepAspectRatio);
-		painter.setViewport(rect.x(), rect.y(), size.width(), size.height());
-		painter.setWindow(img.rect());
-		painter.drawImage(0, 0, img);
-		painter.end();
-		img.save("test.bmp");
-	}
-	QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ӡɹ"));
+	printer.setFromTo(1, totalPages);
+
+	//ѡӡҳ뷶Χ
+	QPrintDialog dialog(&printer, this);
+	dialog.setMinMax(1, totalPages);
+	dialog.setOption(QAbstractPrintDialog::PrintPageRange);
+	if (dialog.exec() != QDialog::Accepted){
+		return;
+	}
+	int fromPage = 0;
+	int toPage = totalPages - 1;
+	if (printer.printRange() == QPrinter::PageRange){
+		fromPage = printer.fromPage() - 1;
+		toPage = printer.toPage() - 1;
+	}
+
+	//ӡֱʷȾȾߴӡ
+	PrintJob job(document, &printer);
+	job.setPageRange(fromPage, toPage);
+	//.pwg/.pcl/.pclmļʱֱɴӡդ
+	QString suffix = QFileInfo(printer.outputFileName()).suffix().toLower();
+	if (suffix == "pwg" || suffix == "pcl" || suffix == "pclm"){
+		MuPDF::Spooler::Format format = (suffix == "pwg") ? MuPDF::Spooler::PWG
+			: (suffix == "pcl") ? MuPDF::Spooler::PCL : MuPDF::Spooler::PCLm;
+		MuPDF::Spooler::ColorMode mode = MuPDF::Spooler::Color;
+		if (printer.colorMode() == QPrinter::GrayScale){
+			mode = (format == MuPDF::Spooler::PCL) ? MuPDF::Spooler::Mono : MuPDF::Spooler::Gray;
+		}
+		job.setSpoolOutput(printer.outputFileName(), format, mode);
+	}
+	QProgressDialog progress(QStringLiteral("ڴӡ..."), QStringLiteral("ȡ"), 0, toPage - fromPage + 1, this);
+	progress.setWindowModality(Qt::WindowModal);
+	connect(&job, &PrintJob::progress, &progress, &QProgressDialog::setValue);
+	connect(&progress, &QProgressDialog::canceled, &job, &PrintJob::cancel);
+	bool ok = job.exec();
+	progress.reset();
+
+	if (ok){
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ӡɹ"));
+	}
+	else if (!job.errorString().isEmpty()){
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ӡʧܣ") + job.errorString());
+	}
+	else{
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ӡȡ"));
+	}
+}
+
+void QMuPDFReader::sltNightMode()
+{
+	if (ui.pdfPages->colorEffect() == MuPDF::InvertColors){
+		ui.pdfPages->setColorEffect(MuPDF::NoEffect);
+	}
+	else{
+		ui.pdfPages->setColorEffect(MuPDF::InvertColors);
+	}
+	//ͼµɫЧȾ
+	ui.thumbnailView->thumbnailModel()->invalidate();
+}
+
+void QMuPDFReader::sltToggleAnnotations()
+{
+	ui.pdfPages->setShowAnnotations(!ui.pdfPages->showAnnotations());
+}
+
+void QMuPDFReader::sltSavePDF()
+{
+	MuPDF::Document *document = ui.pdfPages->document();
+	if (!document){
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ȴPDFļ"));
+		return;
+	}
+	if (!document->isModified()){
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ĵû޸"));
+		return;
+	}
+	//ֻ׷޸ĹĶ󣬺ʱȡ޸ļС
+	saveDocument(document->filePath(), MuPDF::SaveIncremental);
+}
+
+void QMuPDFReader::sltSavePDFAs()
+{
+	MuPDF::Document *document = ui.pdfPages->document();
+	if (!document){
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ȴPDFļ"));
+		return;
+	}
+	QString file = QFileDialog::getSaveFileName(this,
+		tr("Save PDF file"), ".", "PDF (*.pdf)");
+	if (file.isEmpty()){
+		return;
+	}
+	//д±ö
+	saveDocument(file, MuPDF::SaveFull);
+}
+
+void QMuPDFReader::saveDocument(const QString &file, MuPDF::SaveMode mode)
+{
+	//̨̱߳棬汣Ӧ
+	SaveJob job(ui.pdfPages->document(), file, mode);
+	//δ֪ʾæµ״̬
+	QProgressDialog progress(QStringLiteral("ڱ..."), QStringLiteral("ȡ"), 0, (mode == MuPDF::SaveFull) ? 100 : 0, this);
+	progress.setWindowModality(Qt::WindowModal);
+	connect(&job, &SaveJob::progress, &progress, &QProgressDialog::setValue);
+	connect(&progress, &QProgressDialog::canceled, &job, &SaveJob::cancel);
+	QEventLoop loop;
+	connect(&job, &QThread::finished, &loop, &QEventLoop::quit);
+	job.start();
+	loop.exec();
+	progress.reset();
+
+	if (job.isSaved()){
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ɹ"));
+	}
+	else if (!job.errorString().isEmpty()){
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ʧܣ") + job.errorString());
+	}
+	else{
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ȡ"));
+	}
+}
+
+void QMuPDFReader::sltExportText()
+{
+	MuPDF::Document *document = ui.pdfPages->document();
+	if (!document){
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ȴPDFļ"));
+		return;
+	}
+	QString filter;
+	QString file = QFileDialog::getSaveFileName(this,
+		tr("Export text"), ".", "Text (*.txt);;HTML (*.html);;XHTML (*.xhtml);;XML (*.xml)", &filter);
+	if (file.isEmpty()){
+		return;
+	}
+	MuPDF::TextFormat format = MuPDF::PlainText;
+	if (filter.startsWith("HTML")){
+		format = MuPDF::HtmlText;
+	}
+	else if (filter.startsWith("XHTML")){
+		format = MuPDF::XhtmlText;
+	}
+	else if (filter.startsWith("XML")){
+		format = MuPDF::XmlText;
+	}
+
+	//̰߳ҳȡҳдļ
+	ExportJob job(document, file, format);
+	QProgressDialog progress(QStringLiteral("ڵ..."), QStringLiteral("ȡ"), 0, 100, this);
+	progress.setWindowModality(Qt::WindowModal);
+	connect(&job, &ExportJob::progress, &progress, &QProgressDialog::setValue);
+	connect(&progress, &QProgressDialog::canceled, &job, &ExportJob::cancel);
+	QEventLoop loop;
+	connect(&job, &QThread::finished, &loop, &QEventLoop::quit);
+	job.start();
+	loop.exec();
+	progress.reset();
+
+	if (job.isExported()){
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ɹ"));
+	}
+	else if (!job.errorString().isEmpty()){
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ʧܣ") + job.errorString());
+	}
+	else{
+		QMessageBox::information(NULL, QStringLiteral("ʾ"), QStringLiteral("ȡ"));
+	}
+}
+
+void QMuPDFReader::sltThumbnailClicked(int page)
+{
+	ui.pdfPages->goToPage(page);
+	ui.scrollArea->verticalScrollBar()->setValue(ui.pdfPages->yForPage());
 }
 
 void QMuPDFReader::sltGoToPage()
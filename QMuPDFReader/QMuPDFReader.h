@@ -2,6 +2,7 @@
 
 #include <QtWidgets/QWidget>
 #include "ui_QMuPDFReader.h"
+#include "mupdfdocument.h"
 
 class QMuPDFReader : public QWidget
 {
@@ -28,11 +29,24 @@ protected slots:
 	void sltGoToPage();
 	//
 	void sltUpdateInfo(int pageIndex, int totalPages, qreal zoom);
+	//ҹģʽ
+	void sltNightMode();
+	//ʾ/ע
+	void sltToggleAnnotations();
+	//ͼת
+	void sltThumbnailClicked(int page);
+	//()
+	void sltSavePDF();
+	//Ϊ(д)
+	void sltSavePDFAs();
+	//ı/HTML
+	void sltExportText();
 
 private:
 	virtual void mousePressEvent(QMouseEvent *event);
 	virtual void mouseReleaseEvent(QMouseEvent *event);
 	virtual void mouseMoveEvent(QMouseEvent *event);
+	void saveDocument(const QString &file, MuPDF::SaveMode mode);
 
 private:
     Ui::QMuPDFReaderClass ui;
@@ -0,0 +1,202 @@
+#include "compressedimagecache.h"
+#include "qoicodec.h"
+#include "tracing.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThreadPool>
+
+class CompressedImageCache::CompressTask : public QRunnable
+{
+public:
+    CompressTask(CompressedImageCache *cache, int key, const QImage &image, int generation)
+        : m_cache(cache)
+        , m_key(key)
+        , m_image(image)
+        , m_generation(generation)
+    {
+    }
+
+    void run()
+    {
+        QByteArray data;
+        {
+            TRACE_SPAN("cache", "CompressedImageCache::compress");
+            data = Qoi::pack(m_image);
+        }
+        // the image shares its pixels with the view, let them go early
+        m_image = QImage();
+        m_cache->store(m_key, data, m_generation);
+    }
+
+private:
+    CompressedImageCache *m_cache;
+    int m_key;
+    QImage m_image;
+    int m_generation;
+};
+
+/**
+ * @param maximumSize budget in bytes for the compressed data
+ */
+CompressedImageCache::CompressedImageCache(qint64 maximumSize)
+    : m_maximumSize(maximumSize)
+    , m_size(0)
+    , m_generation(0)
+    , m_pendingTasks(0)
+{
+}
+
+/**
+ * @brief Waits for running compressions.
+ */
+CompressedImageCache::~CompressedImageCache()
+{
+    QMutexLocker locker(&m_mutex);
+    while (m_pendingTasks > 0)
+    {
+        m_tasksDone.wait(&m_mutex);
+    }
+}
+
+qint64 CompressedImageCache::maximumSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_maximumSize;
+}
+
+void CompressedImageCache::setMaximumSize(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maximumSize = bytes;
+    trim();
+}
+
+/**
+ * @brief Compressed size of all entries in bytes.
+ */
+qint64 CompressedImageCache::size() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_size;
+}
+
+bool CompressedImageCache::contains(int key) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.contains(key);
+}
+
+/**
+ * @brief Decompress an entry; it stays in the cache.
+ *
+ * @return a null image if there is no entry for @p key, also while its
+ *         compression is still running
+ */
+QImage CompressedImageCache::value(int key)
+{
+    QByteArray data;
+    {
+        QMutexLocker locker(&m_mutex);
+        data = m_entries.value(key);
+        if (data.isEmpty())
+            return QImage();
+        m_lru.removeOne(key);
+        m_lru.append(key);
+    }
+    // decode outside the lock, the array is an implicitly shared copy
+    TRACE_SPAN("cache", "CompressedImageCache::decompress");
+    return Qoi::unpack(reinterpret_cast<const uchar *>(data.constData()), data.size());
+}
+
+/**
+ * @brief Compress @p image in the background and keep it under @p key,
+ * replacing an older entry.
+ */
+void CompressedImageCache::insert(int key, const QImage &image)
+{
+    if (image.isNull())
+    {
+        return;
+    }
+    QMutexLocker locker(&m_mutex);
+    ++m_pendingTasks;
+    QThreadPool::globalInstance()->start(new CompressTask(this, key, image, m_generation));
+}
+
+void CompressedImageCache::remove(int key)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_entries.contains(key))
+    {
+        m_size -= m_entries.take(key).size();
+        m_lru.removeOne(key);
+    }
+}
+
+/**
+ * @brief Remove all entries, including those still being compressed.
+ */
+void CompressedImageCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_entries.clear();
+    m_lru.clear();
+    m_size = 0;
+    ++m_generation;
+}
+
+qint64 CompressedImageCache::memoryUsage() const
+{
+    return size();
+}
+
+/**
+ * @brief Drop least recently used entries.
+ */
+qint64 CompressedImageCache::releaseMemory(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    const qint64 before = m_size;
+    while (before - m_size < bytes && !m_lru.isEmpty())
+    {
+        m_size -= m_entries.take(m_lru.takeFirst()).size();
+    }
+    return before - m_size;
+}
+
+/**
+ * @brief Called by the compression tasks.
+ */
+void CompressedImageCache::store(int key, const QByteArray &data, int generation)
+{
+    QMutexLocker locker(&m_mutex);
+    if (generation == m_generation && !data.isEmpty() && data.size() <= m_maximumSize)
+    {
+        if (m_entries.contains(key))
+        {
+            m_size -= m_entries.value(key).size();
+            m_lru.removeOne(key);
+        }
+        m_entries.insert(key, data);
+        m_lru.append(key);
+        m_size += data.size();
+        trim();
+    }
+    if (--m_pendingTasks == 0)
+    {
+        m_tasksDone.wakeAll();
+    }
+}
+
+/**
+ * @brief Drop least recently used entries until the cache fits.
+ * Call with the mutex locked.
+ */
+void CompressedImageCache::trim()
+{
+    while (m_size > m_maximumSize && !m_lru.isEmpty())
+    {
+        m_size -= m_entries.take(m_lru.takeFirst()).size();
+    }
+}
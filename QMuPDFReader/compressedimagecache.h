@@ -0,0 +1,62 @@
+#ifndef COMPRESSEDIMAGECACHE_H
+#define COMPRESSEDIMAGECACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+#include "memorygovernor.h"
+
+/**
+ * @brief Memory cache of QOI compressed images, the tier behind a cache of
+ * raw images.
+ *
+ * Rendered pages are mostly paper color and compress to a small fraction
+ * of their raw size, so many more of them fit into the same budget.
+ * insert() hands the compression to QThreadPool::globalInstance() and
+ * returns at once; value() decompresses on the calling thread, which
+ * takes a few milliseconds for a screen-sized page.
+ */
+class CompressedImageCache : public MemoryConsumer
+{
+public:
+    explicit CompressedImageCache(qint64 maximumSize = 64 << 20);
+    ~CompressedImageCache();
+
+    qint64 maximumSize() const;
+    void setMaximumSize(qint64 bytes);
+    qint64 size() const;
+
+    bool contains(int key) const;
+    QImage value(int key);
+    void insert(int key, const QImage &image);
+    void remove(int key);
+    void clear();
+
+    qint64 memoryUsage() const;
+    qint64 releaseMemory(qint64 bytes);
+
+private:
+    // disable copy
+    CompressedImageCache(const CompressedImageCache &);
+    CompressedImageCache &operator=(const CompressedImageCache &);
+
+    void store(int key, const QByteArray &data, int generation);
+    void trim();
+
+    class CompressTask;
+    friend class CompressTask;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_tasksDone;
+    QHash<int, QByteArray> m_entries;
+    QList<int> m_lru;       // least recently used first
+    qint64 m_maximumSize;
+    qint64 m_size;
+    int m_generation;       // bumped by clear(), drops results of older tasks
+    int m_pendingTasks;
+};
+
+#endif // COMPRESSEDIMAGECACHE_H
@@ -0,0 +1,219 @@
+#include "diskcache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSaveFile>
+
+/**
+ * @param directory created when the first entry is written
+ * @param maximumSize size cap in bytes for all entries together
+ */
+DiskCache::DiskCache(const QString &directory, qint64 maximumSize)
+    : m_directory(directory)
+    , m_maximumSize(maximumSize)
+    , m_size(-1)
+{
+}
+
+QString DiskCache::directory() const
+{
+    return m_directory;
+}
+
+qint64 DiskCache::maximumSize() const
+{
+    return m_maximumSize;
+}
+
+void DiskCache::setMaximumSize(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maximumSize = bytes;
+    trim();
+}
+
+/**
+ * @brief Total size of all entries in bytes.
+ */
+qint64 DiskCache::size()
+{
+    QMutexLocker locker(&m_mutex);
+    scan();
+    return m_size;
+}
+
+bool DiskCache::contains(const QByteArray &key) const
+{
+    return QFile::exists(filePath(key));
+}
+
+/**
+ * @brief Read an entry.
+ *
+ * @return a null QByteArray if there is no entry for @p key.
+ */
+QByteArray DiskCache::value(const QByteArray &key)
+{
+    const QString path = filePath(key);
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return QByteArray();
+    }
+    QByteArray data = file.readAll();
+    file.close();
+    touch(path);
+    return data;
+}
+
+/**
+ * @brief Map an entry into memory instead of reading it, so large
+ * entries can be decoded without copying them first.
+ *
+ * @param file unopened file object; the data stays valid until it is
+ *             unmapped, closed or destroyed
+ * @param size set to the entry size
+ *
+ * @return NULL if there is no entry for @p key.
+ */
+const uchar *DiskCache::map(const QByteArray &key, QFile *file, qint64 *size)
+{
+    const QString path = filePath(key);
+    file->setFileName(path);
+    if (!file->open(QIODevice::ReadOnly))
+    {
+        return NULL;
+    }
+    touch(path);
+    *size = file->size();
+    const uchar *data = *size > 0 ? file->map(0, *size) : NULL;
+    if (!data)
+    {
+        file->close();
+    }
+    return data;
+}
+
+/**
+ * @brief Write an entry, replacing an older one with the same key.
+ */
+bool DiskCache::insert(const QByteArray &key, const QByteArray &data)
+{
+    if (data.size() > m_maximumSize || !QDir().mkpath(m_directory))
+    {
+        return false;
+    }
+
+    // Count the existing entries before this one lands on disk, otherwise
+    // the first insert would be summed up by the scan and added again.
+    {
+        QMutexLocker locker(&m_mutex);
+        scan();
+    }
+
+    const QString path = filePath(key);
+    const qint64 oldSize = QFileInfo(path).size();
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)
+            || file.write(data) != data.size()
+            || !file.commit())
+    {
+        return false;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_size += data.size() - oldSize;
+    trim();
+    return true;
+}
+
+void DiskCache::remove(const QByteArray &key)
+{
+    const QString path = filePath(key);
+    const qint64 oldSize = QFileInfo(path).size();
+    if (QFile::remove(path))
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_size >= 0)
+            m_size -= oldSize;
+    }
+}
+
+void DiskCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    QDir dir(m_directory);
+    foreach (const QString &name, dir.entryList(QStringList("*.cache"), QDir::Files))
+    {
+        dir.remove(name);
+    }
+    m_size = 0;
+}
+
+QString DiskCache::filePath(const QByteArray &key) const
+{
+    const QByteArray name = QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex();
+    return m_directory + QLatin1Char('/') + QString::fromLatin1(name) + QStringLiteral(".cache");
+}
+
+/**
+ * @brief Mark an entry as recently used.
+ */
+void DiskCache::touch(const QString &filePath)
+{
+    QFile file(filePath);
+    if (file.open(QIODevice::ReadWrite))
+    {
+        file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+    }
+}
+
+/**
+ * @brief Sum up the entry sizes once. Call with the mutex locked.
+ */
+void DiskCache::scan()
+{
+    if (m_size >= 0)
+    {
+        return;
+    }
+    m_size = 0;
+    QDir dir(m_directory);
+    foreach (const QFileInfo &info, dir.entryInfoList(QStringList("*.cache"), QDir::Files))
+    {
+        m_size += info.size();
+    }
+}
+
+/**
+ * @brief Delete least recently used entries until the cache fits.
+ * Call with the mutex locked.
+ */
+void DiskCache::trim()
+{
+    if (m_size <= m_maximumSize)
+    {
+        return;
+    }
+
+    // leave some room, so that not every insert has to list the directory
+    const qint64 target = m_maximumSize - m_maximumSize / 10;
+    QDir dir(m_directory);
+    QFileInfoList entries = dir.entryInfoList(QStringList("*.cache"), QDir::Files,
+                                              QDir::Time | QDir::Reversed);
+    foreach (const QFileInfo &info, entries)
+    {
+        if (m_size <= target)
+        {
+            break;
+        }
+        if (dir.remove(info.fileName()))
+        {
+            m_size -= info.size();
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+
+class QFile;
+
+/**
+ * @brief A size-capped key/value store in a directory, shared by all
+ * threads of the process.
+ *
+ * Every entry is one file named after the SHA-1 of its key, written
+ * atomically, so a crash never leaves a truncated entry behind. When the
+ * total size grows beyond maximumSize() the least recently used entries
+ * are deleted; reading an entry refreshes its modification time.
+ */
+class DiskCache
+{
+public:
+    DiskCache(const QString &directory, qint64 maximumSize);
+
+    QString directory() const;
+    qint64 maximumSize() const;
+    void setMaximumSize(qint64 bytes);
+    qint64 size();
+
+    bool contains(const QByteArray &key) const;
+    QByteArray value(const QByteArray &key);
+    const uchar *map(const QByteArray &key, QFile *file, qint64 *size);
+    bool insert(const QByteArray &key, const QByteArray &data);
+    void remove(const QByteArray &key);
+    void clear();
+
+private:
+    // disable copy
+    DiskCache(const DiskCache &);
+    DiskCache &operator=(const DiskCache &);
+
+    QString filePath(const QByteArray &key) const;
+    void touch(const QString &filePath);
+
+    void scan();
+    void trim();
+
+    QString m_directory;
+    qint64 m_maximumSize;
+    qint64 m_size;          // -1 until the directory was scanned
+    QMutex m_mutex;
+};
+
+#endif // DISKCACHE_H
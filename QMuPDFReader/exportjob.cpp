@@ -0,0 +1,80 @@
+#include "exportjob.h"
+#include "tracing.h"
+
+#include <QSaveFile>
+
+/**
+ * @param document must outlive the job
+ */
+ExportJob::ExportJob(MuPDF::Document *document, const QString &filePath,
+                     MuPDF::TextFormat format, QObject *parent)
+    : QThread(parent)
+    , m_document(document)
+    , m_filePath(filePath)
+    , m_format(format)
+    , m_cancelled(0)
+    , m_exported(false)
+{
+}
+
+/**
+ * @brief Cancels a running export and waits for it.
+ */
+ExportJob::~ExportJob()
+{
+    cancel();
+    wait();
+}
+
+/**
+ * @brief Whether the file was written, valid once the thread finished.
+ */
+bool ExportJob::isExported() const
+{
+    return m_exported;
+}
+
+QString ExportJob::errorString() const
+{
+    return m_error;
+}
+
+/**
+ * @brief Stop after the page being written; no file is created.
+ */
+void ExportJob::cancel()
+{
+    m_cancelled.storeRelease(1);
+}
+
+void ExportJob::run()
+{
+    TRACE_SPAN("io", "ExportJob::run");
+    MuPDF::ThreadScope scope(m_document);
+    QSaveFile file(m_filePath);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        m_error = file.errorString();
+        return;
+    }
+    if (!m_document->exportText(&file, m_format, this))
+    {
+        file.cancelWriting();
+        m_error = m_cancelled.loadAcquire() ? QString() : m_document->errorString();
+        return;
+    }
+    m_exported = file.commit();
+    if (!m_exported)
+    {
+        m_error = file.errorString();
+    }
+}
+
+bool ExportJob::saveProgress(qint64 written, qint64 expected)
+{
+    if (expected > 0)
+    {
+        emit progress(int(qMin<qint64>(100, written * 100 / expected)));
+    }
+    return !m_cancelled.loadAcquire();
+}
@@ -0,0 +1,45 @@
+#ifndef EXPORTJOB_H
+#define EXPORTJOB_H
+
+#include <QAtomicInt>
+#include <QString>
+#include <QThread>
+#include "mupdfdocument.h"
+
+/**
+ * @brief Exports the text of a document to a file on a worker thread,
+ * see MuPDF::Document::exportText().
+ */
+class ExportJob : public QThread, private MuPDF::SaveProgress
+{
+    Q_OBJECT
+
+public:
+    ExportJob(MuPDF::Document *document, const QString &filePath,
+              MuPDF::TextFormat format, QObject *parent = NULL);
+    ~ExportJob();
+
+    bool isExported() const;
+    QString errorString() const;
+
+signals:
+    void progress(int percent);
+
+public slots:
+    void cancel();
+
+protected:
+    void run();
+
+private:
+    bool saveProgress(qint64 written, qint64 expected);
+
+    MuPDF::Document *m_document;
+    QString m_filePath;
+    MuPDF::TextFormat m_format;
+    QAtomicInt m_cancelled;
+    bool m_exported;
+    QString m_error;
+};
+
+#endif // EXPORTJOB_H
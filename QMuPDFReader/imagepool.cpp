@@ -0,0 +1,93 @@
+#include "imagepool.h"
+
+#include <QMutexLocker>
+
+/**
+ * @param maximumSize bytes kept in free buffers, older ones are dropped
+ */
+ImagePool::ImagePool(qint64 maximumSize)
+    : m_maximumSize(maximumSize)
+    , m_size(0)
+{
+}
+
+qint64 ImagePool::maximumSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_maximumSize;
+}
+
+void ImagePool::setMaximumSize(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maximumSize = bytes;
+    while (m_size > m_maximumSize && !m_images.isEmpty())
+    {
+        m_size -= m_images.takeFirst().sizeInBytes();
+    }
+}
+
+/**
+ * @brief Bytes held in free buffers.
+ */
+qint64 ImagePool::size() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_size;
+}
+
+/**
+ * @brief Take a free buffer of @p size and @p format, or allocate one.
+ *
+ * @note The pixels are undefined; Page::renderTo() fills them anyway.
+ */
+QImage ImagePool::acquire(const QSize &size, QImage::Format format)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        for (int i = m_images.size() - 1; i >= 0; --i)
+        {
+            const QImage &image = m_images.at(i);
+            if (image.size() == size && image.format() == format)
+            {
+                m_size -= image.sizeInBytes();
+                return m_images.takeAt(i);
+            }
+        }
+    }
+    return QImage(size, format);
+}
+
+/**
+ * @brief Give a buffer back and clear @p image. Buffers still shared with
+ * other QImage copies are not pooled, they would be written to while
+ * in use.
+ */
+void ImagePool::release(QImage &image)
+{
+    if (image.isNull() || !image.isDetached())
+    {
+        image = QImage();
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    const qint64 bytes = image.sizeInBytes();
+    if (bytes <= m_maximumSize)
+    {
+        m_images.append(image);
+        m_size += bytes;
+        while (m_size > m_maximumSize)
+        {
+            m_size -= m_images.takeFirst().sizeInBytes();
+        }
+    }
+    image = QImage();
+}
+
+void ImagePool::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_images.clear();
+    m_size = 0;
+}
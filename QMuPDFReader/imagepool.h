@@ -0,0 +1,41 @@
+#ifndef IMAGEPOOL_H
+#define IMAGEPOOL_H
+
+#include <QImage>
+#include <QList>
+#include <QMutex>
+
+/**
+ * @brief Recycles image buffers of the same size and format, shared by
+ * all threads.
+ *
+ * Renderers that produce many equally sized images (print bands, tiles)
+ * take a buffer with acquire(), render into it with
+ * MuPDF::Page::renderTo() and hand it back with release() once it was
+ * painted, so after the first few calls no pixel memory is allocated.
+ */
+class ImagePool
+{
+public:
+    explicit ImagePool(qint64 maximumSize = 64 << 20);
+
+    qint64 maximumSize() const;
+    void setMaximumSize(qint64 bytes);
+    qint64 size() const;
+
+    QImage acquire(const QSize &size, QImage::Format format);
+    void release(QImage &image);
+    void clear();
+
+private:
+    // disable copy
+    ImagePool(const ImagePool &);
+    ImagePool &operator=(const ImagePool &);
+
+    mutable QMutex m_mutex;
+    QList<QImage> m_images;     // free buffers, most recently released last
+    qint64 m_maximumSize;
+    qint64 m_size;
+};
+
+#endif // IMAGEPOOL_H
@@ -1,10 +1,50 @@
 #include "QMuPDFReader.h"
+#include "memorygovernor.h"
+#include "mupdfdocument.h"
+#include "tracing.h"
 #include <QtWidgets/QApplication>
+#include <QStandardPaths>
+
+/**
+ * @brief MuPDF's glyph caches and resource stores of all documents.
+ */
+class MuPDFMemory : public MemoryConsumer
+{
+public:
+    qint64 memoryUsage() const
+    {
+        return MuPDF::allocatedMemory();
+    }
+
+    qint64 releaseMemory(qint64 bytes)
+    {
+        return MuPDF::releaseMemory(bytes);
+    }
+};
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+#ifdef QMUPDF_TRACING
+    // QMUPDF_TRACE=<file>: record from startup, write the trace on exit
+    const QString traceFile = qEnvironmentVariable("QMUPDF_TRACE");
+    Tracing::setEnabled(!traceFile.isEmpty());
+#endif
+    // reopened and side-by-side documents reuse fonts and glyphs
+    MuPDF::setSharedContext(true);
+    MuPDF::setThumbnailCache(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+                             + QStringLiteral("/thumbnails"));
+    MuPDF::setPageCache(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+                        + QStringLiteral("/pages"));
+    MuPDFMemory mupdfMemory;
+    MemoryGovernor::instance()->addConsumer(&mupdfMemory, MemoryGovernor::MuPDFResources);
     QMuPDFReader w;
     w.show();
-    return a.exec();
+    int ret = a.exec();
+    MemoryGovernor::instance()->removeConsumer(&mupdfMemory);
+#ifdef QMUPDF_TRACING
+    if (!traceFile.isEmpty())
+        Tracing::dump(traceFile);
+#endif
+    return ret;
 }
@@ -0,0 +1,169 @@
+#include "memorygovernor.h"
+#include "tracing.h"
+
+#include <QFile>
+#include <QGuiApplication>
+
+#ifdef Q_OS_WIN
+#include <qt_windows.h>
+#endif
+
+MemoryGovernor::MemoryGovernor(QObject *parent)
+    : QObject(parent)
+    , m_budget(Q_INT64_C(1) << 30)
+    , m_lowMemory(Q_INT64_C(256) << 20)
+{
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(checkMemory()));
+    m_timer.start(2000);
+    connect(qApp, SIGNAL(applicationStateChanged(Qt::ApplicationState)),
+            this, SLOT(applicationStateChanged(Qt::ApplicationState)));
+}
+
+/**
+ * @brief The governor of the application, created on first use.
+ *
+ * @note Call from the GUI thread after QApplication was created.
+ */
+MemoryGovernor *MemoryGovernor::instance()
+{
+    static MemoryGovernor *governor = new MemoryGovernor(qApp);
+    return governor;
+}
+
+/**
+ * @param cost rebuild cost, see Cost; consumers of the same cost are
+ *             trimmed in the order they were added
+ *
+ * @note Call removeConsumer() before @p consumer is destroyed.
+ */
+void MemoryGovernor::addConsumer(MemoryConsumer *consumer, int cost)
+{
+    Consumer entry;
+    entry.consumer = consumer;
+    entry.cost = cost;
+    int i = 0;
+    while (i < m_consumers.size() && m_consumers.at(i).cost <= cost)
+    {
+        ++i;
+    }
+    m_consumers.insert(i, entry);
+}
+
+void MemoryGovernor::removeConsumer(MemoryConsumer *consumer)
+{
+    for (int i = m_consumers.size() - 1; i >= 0; --i)
+    {
+        if (m_consumers.at(i).consumer == consumer)
+            m_consumers.removeAt(i);
+    }
+}
+
+qint64 MemoryGovernor::budget() const
+{
+    return m_budget;
+}
+
+/**
+ * @brief Set the budget for all consumers together, 1 GiB by default.
+ */
+void MemoryGovernor::setBudget(qint64 bytes)
+{
+    m_budget = bytes;
+    checkMemory();
+}
+
+/**
+ * @brief Bytes held by all consumers together.
+ */
+qint64 MemoryGovernor::memoryUsage() const
+{
+    qint64 usage = 0;
+    foreach (const Consumer &entry, m_consumers)
+    {
+        usage += entry.consumer->memoryUsage();
+    }
+    return usage;
+}
+
+/**
+ * @brief Physical memory the system can still hand out without
+ * swapping, or -1 if unknown.
+ */
+qint64 MemoryGovernor::availableSystemMemory()
+{
+#if defined(Q_OS_WIN)
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+    {
+        return qint64(status.ullAvailPhys);
+    }
+#elif defined(Q_OS_LINUX)
+    QFile file(QStringLiteral("/proc/meminfo"));
+    if (file.open(QIODevice::ReadOnly))
+    {
+        // "MemAvailable:   12345678 kB"
+        foreach (const QByteArray &line, file.readAll().split('\n'))
+        {
+            if (line.startsWith("MemAvailable:"))
+            {
+                bool ok = false;
+                const qint64 kb = line.mid(13).trimmed().split(' ').value(0).toLongLong(&ok);
+                if (ok)
+                    return kb * 1024;
+            }
+        }
+    }
+#endif
+    return -1;
+}
+
+/**
+ * @brief Trim consumers, cheapest to rebuild first, until about @p bytes
+ * were released.
+ *
+ * @return bytes actually released
+ */
+qint64 MemoryGovernor::releaseMemory(qint64 bytes)
+{
+    TRACE_SPAN("memory", "MemoryGovernor::releaseMemory");
+    qint64 released = 0;
+    foreach (const Consumer &entry, m_consumers)
+    {
+        if (released >= bytes)
+        {
+            break;
+        }
+        released += entry.consumer->releaseMemory(bytes - released);
+    }
+    return released;
+}
+
+/**
+ * @brief Enforce the budget and react to low system memory; runs every
+ * two seconds.
+ */
+void MemoryGovernor::checkMemory()
+{
+    const qint64 usage = memoryUsage();
+    qint64 excess = usage - m_budget;
+
+    const qint64 available = availableSystemMemory();
+    if (available >= 0 && available < m_lowMemory)
+    {
+        // the system is about to swap, give back half of what we hold
+        excess = qMax(excess, usage / 2);
+    }
+    if (excess > 0)
+    {
+        releaseMemory(excess);
+    }
+}
+
+void MemoryGovernor::applicationStateChanged(Qt::ApplicationState state)
+{
+    if (state == Qt::ApplicationHidden || state == Qt::ApplicationSuspended)
+    {
+        releaseMemory(memoryUsage() / 2);
+    }
+}
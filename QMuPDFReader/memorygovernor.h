@@ -0,0 +1,91 @@
+#ifndef MEMORYGOVERNOR_H
+#define MEMORYGOVERNOR_H
+
+#include <QList>
+#include <QObject>
+#include <QTimer>
+
+/**
+ * @brief Something that holds memory it can give back on demand,
+ * typically a cache.
+ */
+class MemoryConsumer
+{
+public:
+    virtual ~MemoryConsumer() {}
+
+    /**
+     * @brief Bytes currently held.
+     */
+    virtual qint64 memoryUsage() const = 0;
+
+    /**
+     * @brief Drop about @p bytes, least valuable data first.
+     *
+     * @return bytes actually released
+     */
+    virtual qint64 releaseMemory(qint64 bytes) = 0;
+};
+
+/**
+ * @brief Keeps all registered caches within one global budget and trims
+ * them when the machine runs short of memory.
+ *
+ * Consumers are trimmed in order of their rebuild cost, cheapest first:
+ * raw page images (which still have a compressed copy) before
+ * thumbnails, before MuPDF's glyph caches and resource stores, with the
+ * compressed page tier last.
+ *
+ * Memory pressure is polled from the system (MemAvailable in
+ * /proc/meminfo, GlobalMemoryStatusEx() on Windows) and the caches are
+ * halved when the application is hidden or suspended. Lives in the GUI
+ * thread; consumers are called there.
+ */
+class MemoryGovernor : public QObject
+{
+    Q_OBJECT
+
+public:
+    // rebuild cost of a consumer, lower costs are trimmed first
+    enum Cost
+    {
+        RawImages = 0,
+        Thumbnails = 10,
+        MuPDFResources = 20,
+        CompressedImages = 30
+    };
+
+    static MemoryGovernor *instance();
+
+    void addConsumer(MemoryConsumer *consumer, int cost);
+    void removeConsumer(MemoryConsumer *consumer);
+
+    qint64 budget() const;
+    void setBudget(qint64 bytes);
+    qint64 memoryUsage() const;
+
+    static qint64 availableSystemMemory();
+
+public slots:
+    qint64 releaseMemory(qint64 bytes);
+    void checkMemory();
+
+private slots:
+    void applicationStateChanged(Qt::ApplicationState state);
+
+private:
+    explicit MemoryGovernor(QObject *parent = NULL);
+
+    struct Consumer
+    {
+        MemoryConsumer *consumer;
+        int cost;
+    };
+
+    QList<Consumer> m_consumers;    // by cost, cheapest first
+    qint64 m_budget;
+    qint64 m_lowMemory;             // system memory below this is pressure
+    QTimer m_timer;
+};
+
+#endif // MEMORYGOVERNOR_H
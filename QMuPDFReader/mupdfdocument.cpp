@@ -2,14 +2,98 @@
 #include "mupdfdocument_p.h"
 #include "mupdfpage.h"
 #include "mupdfpage_p.h"
+#include "diskcache.h"
+#include "qoicodec.h"
+#include "tracing.h"
 #include "fitz.h"
 
 #include <QString>
+#include <QBuffer>
+#include <QCryptographicHash>
 #include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QSaveFile>
+#include <QImage>
+#include <QAtomicInteger>
+#include <QMap>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSet>
+#include <QSize>
+#include <QSizeF>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
 
 namespace MuPDF
 {
 
+// innermost ThreadScope of the current thread
+static thread_local ThreadScope *currentScope = NULL;
+
+// shared by all documents, see setThumbnailCache()
+static QMutex thumbnailCacheMutex;
+static DiskCache *thumbnailCache = NULL;
+// see setPageCache()
+static QMutex pageCacheMutex;
+static DiskCache *pageCache = NULL;
+
+// open documents, see releaseMemory()
+static QMutex documentsMutex;
+static QList<DocumentPrivate *> documents;
+
+// bytes allocated by all MuPDF contexts, see allocatedMemory()
+static QAtomicInteger<qint64> allocated(0);
+
+// the counting allocator keeps each block's size in front of it; 16 bytes
+// keep the alignment malloc gives
+static const size_t allocHeader = 16;
+
+static void *countingMalloc(void *user, size_t size)
+{
+    Q_UNUSED(user)
+    char *block = static_cast<char *>(malloc(size + allocHeader));
+    if (!block)
+        return NULL;
+    *reinterpret_cast<size_t *>(block) = size;
+    allocated.fetchAndAddRelaxed(qint64(size));
+    return block + allocHeader;
+}
+
+static void *countingRealloc(void *user, void *old, size_t size)
+{
+    if (!old)
+        return countingMalloc(user, size);
+    char *block = static_cast<char *>(old) - allocHeader;
+    const size_t oldSize = *reinterpret_cast<size_t *>(block);
+    block = static_cast<char *>(realloc(block, size + allocHeader));
+    if (!block)
+        return NULL;
+    *reinterpret_cast<size_t *>(block) = size;
+    allocated.fetchAndAddRelaxed(qint64(size) - qint64(oldSize));
+    return block + allocHeader;
+}
+
+static void countingFree(void *user, void *ptr)
+{
+    Q_UNUSED(user)
+    if (!ptr)
+        return;
+    char *block = static_cast<char *>(ptr) - allocHeader;
+    allocated.fetchAndAddRelaxed(-qint64(*reinterpret_cast<size_t *>(block)));
+    free(block);
+}
+
+static fz_alloc_context countingAllocator = { NULL, countingMalloc, countingRealloc, countingFree };
+
+// see setSharedContext(); documents clone it instead of creating their own
+static QMutex sharedContextMutex;
+static fz_context *sharedContext = NULL;
+static QMutex sharedMutexes[FZ_LOCK_MAX];
+static fz_locks_context sharedLocks = { sharedMutexes, DocumentPrivate::lockMutex, DocumentPrivate::unlockMutex };
+
 /**
  * @brief Load a document.
  *
@@ -37,18 +121,168 @@ Document * loadDocument(const QString &filePath)
     return document;
 }
 
+/**
+ * @brief Keep thumbnails in @p directory across sessions, so reopening a
+ * document shows them without rendering. Entries are keyed by a hash of
+ * the file content, so renamed or copied files still hit the cache.
+ *
+ * @param directory cache directory; an empty path disables the cache
+ * @param maximumSize size cap in bytes, least recently used entries go first
+ */
+void setThumbnailCache(const QString &directory, qint64 maximumSize)
+{
+    QMutexLocker locker(&thumbnailCacheMutex);
+    delete thumbnailCache;
+    thumbnailCache = directory.isEmpty() ? NULL : new DiskCache(directory, maximumSize);
+}
+
+/**
+ * @brief Keep rendered pages in @p directory across sessions, see
+ * Document::cachedPage(). Entries are QOI compressed, about a tenth of
+ * the raw pixels for text pages, and keyed like thumbnails.
+ *
+ * @param directory cache directory; an empty path disables the cache
+ * @param maximumSize size cap in bytes, least recently used entries go first
+ */
+void setPageCache(const QString &directory, qint64 maximumSize)
+{
+    QMutexLocker locker(&pageCacheMutex);
+    delete pageCache;
+    pageCache = directory.isEmpty() ? NULL : new DiskCache(directory, maximumSize);
+}
+
+/**
+ * @brief Let documents loaded from now on share one MuPDF context.
+ *
+ * By default every document gets its own context with its own resource
+ * store, glyph cache and font state. With a shared context, documents
+ * open side by side reuse each other's fonts and glyphs, and one bounded
+ * store holds the decoded resources of all of them. Documents stay
+ * independent otherwise: each keeps its own document lock, so they can
+ * still render in parallel.
+ *
+ * Documents loaded before keep the context they have.
+ *
+ * @param enable false goes back to one context per document
+ * @param storeSize size cap of the shared resource store in bytes
+ */
+void setSharedContext(bool enable, qint64 storeSize)
+{
+    QMutexLocker locker(&sharedContextMutex);
+    if (sharedContext)
+    {
+        // documents using it hold references to the store and caches
+        fz_drop_context(sharedContext);
+        sharedContext = NULL;
+    }
+    if (enable)
+    {
+        sharedContext = fz_new_context(&countingAllocator, &sharedLocks, size_t(storeSize));
+        if (sharedContext)
+            fz_register_document_handlers(sharedContext);
+    }
+}
+
+/**
+ * @brief Bytes currently allocated by MuPDF for all documents: resource
+ * stores (decoded images, fonts), glyph caches, display lists and
+ * parsed objects.
+ */
+qint64 allocatedMemory()
+{
+    return allocated.loadAcquire();
+}
+
+/**
+ * @brief Give memory back under pressure, cheapest to rebuild first: the
+ * glyph caches, then the resource stores in halving steps (fonts and
+ * decoded images have to be loaded again when they are needed).
+ *
+ * Safe to call from any thread while pages render; items in use stay.
+ *
+ * @param bytes how much should be released
+ *
+ * @return bytes actually released
+ */
+qint64 releaseMemory(qint64 bytes)
+{
+    const qint64 before = allocatedMemory();
+    QMutexLocker locker(&documentsMutex);
+    // one context per store, a store shared by documents is trimmed once
+    QList<fz_context *> contexts;
+    QList<fz_store *> stores;
+    foreach (DocumentPrivate *documentp, documents)
+    {
+        if (stores.contains(documentp->context->store))
+            continue;
+        fz_context *ctx = fz_clone_context(documentp->context);
+        if (ctx)
+        {
+            contexts << ctx;
+            stores << ctx->store;
+        }
+    }
+
+    foreach (fz_context *ctx, contexts)
+    {
+        fz_purge_glyph_cache(ctx);
+    }
+    for (int step = 0; step < 4 && before - allocatedMemory() < bytes; ++step)
+    {
+        foreach (fz_context *ctx, contexts)
+        {
+            if (step < 3)
+                fz_shrink_store(ctx, 50);
+            else
+                fz_empty_store(ctx);
+        }
+    }
+
+    foreach (fz_context *ctx, contexts)
+    {
+        fz_drop_context(ctx);
+    }
+    const qint64 released = qMax(Q_INT64_C(0), before - allocatedMemory());
+    TRACE_INSTANT("memory", "MuPDF::releaseMemory", int(released >> 10));
+    return released;
+}
+
 DocumentPrivate::DocumentPrivate(const QString &filePath)
     : context(NULL), document(NULL)
+    , filePath(filePath)
     , transparent(false)
     , b(-1), g(-1), r(-1), a(-1)
+    , effect(NoEffect)
+    , tintR(255), tintG(240), tintB(205)
+    , gamma(1.0f)
+    , renderMode(RenderColor)
+    , editCount(0)
+    , documentMutex(QMutex::Recursive)
 {
+    locks.user = mutexes;
+    locks.lock = lockMutex;
+    locks.unlock = unlockMutex;
+
     // create context
-    context = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+    {
+        QMutexLocker locker(&sharedContextMutex);
+        if (sharedContext)
+            context = fz_clone_context(sharedContext);
+    }
     if (!context)
-        return;
+    {
+        // the store is unlimited, releaseMemory() trims it under pressure
+        context = fz_new_context(&countingAllocator, &locks, FZ_STORE_UNLIMITED);
+        if (!context)
+            return;
 
-    // register the default file types
-    fz_register_document_handlers(context);
+        // register the default file types
+        fz_register_document_handlers(context);
+    }
+    {
+        QMutexLocker locker(&documentsMutex);
+        documents << this;
+    }
 
     // open document
     fz_try(context)
@@ -61,6 +295,63 @@ DocumentPrivate::DocumentPrivate(const QString &filePath)
     }
 }
 
+void DocumentPrivate::lockMutex(void *user, int lock)
+{
+    static_cast<QMutex *>(user)[lock].lock();
+}
+
+void DocumentPrivate::unlockMutex(void *user, int lock)
+{
+    static_cast<QMutex *>(user)[lock].unlock();
+}
+
+/**
+ * @brief Context to use on the calling thread: the clone of the innermost
+ * ThreadScope for this document, or the document's own context.
+ */
+fz_context *DocumentPrivate::threadContext() const
+{
+    for (ThreadScope *scope = currentScope; scope; scope = scope->previous)
+    {
+        if (scope->d == this && scope->context)
+            return static_cast<fz_context *>(scope->context);
+    }
+    return context;
+}
+
+/**
+ * @brief Render settings as part of cache keys.
+ */
+QByteArray DocumentPrivate::settingsKey() const
+{
+    return QByteArray::number(renderMode)
+            + '/' + QByteArray::number(effect)
+            + '/' + QByteArray::number(tintR) + ',' + QByteArray::number(tintG) + ',' + QByteArray::number(tintB)
+            + '/' + QByteArray::number(gamma)
+            + '/' + QByteArray::number(transparent ? 1 : 0)
+            + '/' + QByteArray::number(r) + ',' + QByteArray::number(g) + ',' + QByteArray::number(b) + ',' + QByteArray::number(a);
+}
+
+/**
+ * @brief Clone the document's context for the current thread.
+ *
+ * @param document the document to use, must outlive this object
+ */
+ThreadScope::ThreadScope(Document *document)
+    : d(document->d)
+    , context(fz_clone_context(document->d->context))
+    , previous(currentScope)
+{
+    currentScope = this;
+}
+
+ThreadScope::~ThreadScope()
+{
+    currentScope = previous;
+    fz_drop_context(static_cast<fz_context *>(context));
+    context = NULL;
+}
+
 /**
  * @brief Destructor
  */
@@ -98,12 +389,14 @@ bool Document::authPassword(const QString &password)
  */
 int Document::numPages() const
 {
+    QMutexLocker locker(&d->documentMutex);
+    fz_context *ctx = d->threadContext();
     int ret = 0;
-    fz_try(d->context)
+    fz_try(ctx)
     {
-        ret = fz_count_pages(d->context, d->document);
+        ret = fz_count_pages(ctx, d->document);
     }
-    fz_catch(d->context)
+    fz_catch(ctx)
     {
         ret = -1;
     }
@@ -114,16 +407,23 @@ int Document::numPages() const
  * @brief Get a page.
  *
  * @param index page index, begin with 0
+ * @param displayList false to skip recording the page contents, for
+ *                    pages that are rendered once or only edited
  *
  * @return You need delete this manually when it's useless.
  */
-Page * Document::page(int index) const
+Page * Document::page(int index, bool displayList) const
+{
+    return loadPage(index, displayList);
+}
+
+Page * Document::loadPage(int index, bool buildDisplayList) const
 {
     PagePrivate *pagep;
     Page *page;
 
     // Create PagePrivate
-    pagep = new PagePrivate(d, index);
+    pagep = new PagePrivate(d, index, buildDisplayList);
     if (!pagep)
         return NULL;
     else if (!pagep->page)
@@ -135,10 +435,868 @@ Page * Document::page(int index) const
     // Create Page
     page = new Page(pagep);
     if (page)
+    {
+        QMutexLocker locker(&d->documentMutex);
         d->pages << pagep;
+    }
     return page;
 }
 
+/**
+ * @brief Settings key of annotation layers and thumbnails, empty once the
+ * document was edited in memory (see Page::setTextFieldValue()).
+ *
+ * Edited layers are not on disk, only the widget keeps them: the file
+ * hash does not cover unsaved edits and an edit counter restarts with
+ * every open, so no key could tell the edits of two sessions apart.
+ *
+ * @param pagep take the settings of this page instead of the current
+ *              ones of the document
+ */
+static QByteArray annotationSettingsKey(DocumentPrivate *d, const PagePrivate *pagep = NULL)
+{
+    QMutexLocker locker(&d->documentMutex);
+    if (d->editCount > 0)
+        return QByteArray();
+    return pagep ? pagep->settingsKey : d->settingsKey();
+}
+
+/**
+ * @brief Thumbnail cache key for the render @p settings, see
+ * DocumentPrivate::settingsKey().
+ */
+static QByteArray thumbnailKey(const QByteArray &fileHash, int index, const QSize &size, RenderMode mode,
+                               const QByteArray &settings)
+{
+    return "thumbnail/" + fileHash.toHex()
+            + '/' + QByteArray::number(index)
+            + '/' + QByteArray::number(size.width()) + 'x' + QByteArray::number(size.height())
+            + '/' + QByteArray::number(mode)
+            + '/' + settings;
+}
+
+/**
+ * @brief Render a page to fit into @p size pixels, keeping its aspect
+ * ratio, for navigators and file pickers.
+ *
+ * The page is drawn once, so no display list is recorded for it; it is
+ * rendered with reduced anti-aliasing. With setThumbnailCache() results
+ * are read from and written to the disk cache; the cache lock is only
+ * held to find and map an entry, reading and decoding it run unlocked.
+ *
+ * Color effect and gamma settings of the document apply. Annotations,
+ * e.g. filled form fields, are drawn on the page; while the document has
+ * unsaved edits the disk cache is not used, see annotationSettingsKey().
+ *
+ * @param index page index, begin with 0
+ * @param size bounding box of the thumbnail in pixels
+ * @param mode RenderMono gives 1-bit thumbnails
+ *
+ * @return a null image if the page cannot be rendered
+ */
+QImage Document::thumbnail(int index, const QSize &size, RenderMode mode) const
+{
+    if (size.isEmpty())
+    {
+        return QImage();
+    }
+
+    bool cached;
+    {
+        QMutexLocker locker(&thumbnailCacheMutex);
+        cached = thumbnailCache != NULL;
+    }
+    QByteArray key;
+    if (cached)
+    {
+        // fileHash() reads the file the first time, not under the cache lock
+        const QByteArray settings = annotationSettingsKey(d);
+        if (!settings.isEmpty())
+            key = thumbnailKey(fileHash(), index, size, mode, settings);
+    }
+
+    if (!key.isEmpty())
+    {
+        QFile file;
+        qint64 fileSize = 0;
+        const uchar *data = NULL;
+        {
+            QMutexLocker locker(&thumbnailCacheMutex);
+            if (thumbnailCache)
+                data = thumbnailCache->map(key, &file, &fileSize);
+        }
+        // read and decoded from the mapping without the lock
+        const QImage image = data ? QImage::fromData(data, int(fileSize), "PNG") : QImage();
+        if (!image.isNull())
+        {
+            TRACE_INSTANT("cache", "thumbnail disk hit", index);
+            return image;
+        }
+    }
+
+    QImage image;
+    Page *page = loadPage(index, false);
+    if (page)
+    {
+        TRACE_SPAN("render", "Document::thumbnail");
+        // the settings may have changed since the lookup, store the image
+        // under the settings it is rendered with
+        if (!key.isEmpty())
+        {
+            const QByteArray settings = annotationSettingsKey(d, page->d);
+            key = settings.isEmpty() ? QByteArray() : thumbnailKey(fileHash(), index, size, mode, settings);
+        }
+        QSizeF pageSize = page->size();
+        if (pageSize.width() > 0 && pageSize.height() > 0)
+        {
+            const float scale = qMin(size.width() / pageSize.width(), size.height() / pageSize.height());
+            page->setRenderMode(mode);
+            page->setAntiAliasing(2);
+            page->setShowAnnotations(true);
+            image = page->renderImage(scale, scale);
+        }
+        delete page;
+    }
+
+    if (!key.isEmpty() && !image.isNull())
+    {
+        QByteArray data;
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        if (image.save(&buffer, "PNG"))
+        {
+            QMutexLocker locker(&thumbnailCacheMutex);
+            if (thumbnailCache)
+                thumbnailCache->insert(key, data);
+        }
+    }
+    return image;
+}
+
+/**
+ * @brief Page cache key; scales are bucketed to 1/1000, finer steps
+ * change the image size by less than a pixel on any sane page.
+ */
+static QByteArray pageKey(const char *kind, const QByteArray &fileHash, int index, float scale,
+                          const QByteArray &settings)
+{
+    return kind + ('/' + fileHash.toHex())
+            + '/' + QByteArray::number(index)
+            + '/' + QByteArray::number(qRound(scale * 1000))
+            + '/' + settings;
+}
+
+/**
+ * @brief Look a rendered page up in the page cache, see setPageCache().
+ *
+ * A hit is decoded straight from the memory-mapped cache file; MuPDF is
+ * not involved at all, so neither a ThreadScope nor the document lock is
+ * needed. Keys cover the document content, page, scale and all render
+ * settings of the document (render mode, color effect, tint, gamma,
+ * transparency and background color).
+ *
+ * @param index page index, begin with 0
+ * @param scale scale of Page::renderImage()
+ *
+ * @return a null image on a miss or without page cache
+ */
+QImage Document::cachedPage(int index, float scale) const
+{
+    {
+        QMutexLocker locker(&pageCacheMutex);
+        if (!pageCache)
+            return QImage();
+    }
+
+    QByteArray settings;
+    {
+        QMutexLocker locker(&d->documentMutex);
+        settings = d->settingsKey();
+    }
+    const QByteArray key = pageKey("page", fileHash(), index, scale, settings);
+    QFile file;
+    qint64 size = 0;
+    const uchar *data = NULL;
+    {
+        QMutexLocker locker(&pageCacheMutex);
+        if (pageCache)
+            data = pageCache->map(key, &file, &size);
+    }
+    if (!data)
+    {
+        return QImage();
+    }
+
+    TRACE_SPAN("cache", "Document::cachedPage");
+    return Qoi::unpack(data, size);
+}
+
+/**
+ * @brief Encodes an image and writes it to the page cache on the global
+ * thread pool. Only needs the key, so it may outlive the document.
+ */
+class PageCacheWriteTask : public QRunnable
+{
+public:
+    PageCacheWriteTask(const QByteArray &key, const QImage &image)
+        : m_key(key)
+        , m_image(image)
+    {
+    }
+
+    void run()
+    {
+        // a single '-' records a page without annotations
+        QByteArray data("-");
+        if (!m_image.isNull())
+        {
+            TRACE_SPAN("cache", "PageCacheWriteTask encode");
+            data = Qoi::pack(m_image);
+            m_image = QImage();
+        }
+        if (data.isEmpty())
+        {
+            return;
+        }
+        QMutexLocker locker(&pageCacheMutex);
+        if (pageCache)
+            pageCache->insert(m_key, data);
+    }
+
+private:
+    QByteArray m_key;
+    QImage m_image;
+};
+
+/**
+ * @brief Store a rendered page in the page cache. Returns at once:
+ * compressing and writing the file run on QThreadPool::globalInstance(),
+ * so the render thread goes on with the next page. Does nothing without
+ * page cache.
+ *
+ * The key covers the settings @p page took from the document when it was
+ * loaded, not the current ones, which may have changed while it rendered.
+ * Pages whose settings were changed with Page setters are not cached.
+ *
+ * @param image result of page->renderImage(scale, scale); 1-bit images
+ *              are not cached
+ */
+void Document::cachePage(const Page *page, float scale, const QImage &image) const
+{
+    {
+        QMutexLocker locker(&pageCacheMutex);
+        if (!pageCache)
+            return;
+    }
+    if (image.isNull() || page->d->settingsKey.isEmpty())
+    {
+        return;
+    }
+
+    const QByteArray key = pageKey("page", fileHash(), page->d->index, scale, page->d->settingsKey);
+    QThreadPool::globalInstance()->start(new PageCacheWriteTask(key, image));
+}
+
+/**
+ * @brief Look the annotation layer of a page up in the page cache, see
+ * Page::renderAnnotations() and cachedPage().
+ *
+ * @param layer receives the layer, a null image if the page has no
+ *              annotations
+ *
+ * @return false on a miss or without page cache
+ */
+bool Document::cachedAnnotations(int index, float scale, QImage *layer) const
+{
+    {
+        QMutexLocker locker(&pageCacheMutex);
+        if (!pageCache)
+            return false;
+    }
+
+    const QByteArray settings = annotationSettingsKey(d);
+    if (settings.isEmpty())
+    {
+        return false;
+    }
+    const QByteArray key = pageKey("annotations", fileHash(), index, scale, settings);
+    QFile file;
+    qint64 size = 0;
+    const uchar *data = NULL;
+    {
+        QMutexLocker locker(&pageCacheMutex);
+        if (pageCache)
+            data = pageCache->map(key, &file, &size);
+    }
+    if (!data)
+    {
+        return false;
+    }
+
+    TRACE_SPAN("cache", "Document::cachedAnnotations");
+    // a single '-' records a page without annotations
+    if (size == 1 && data[0] == '-')
+    {
+        *layer = QImage();
+        return true;
+    }
+    *layer = Qoi::unpack(data, size);
+    return !layer->isNull();
+}
+
+/**
+ * @brief Store the annotation layer of a page in the page cache in the
+ * background, like cachePage(). A null @p layer records that the page has none, so it is
+ * not loaded again just to find out.
+ *
+ * Nothing is stored once the document was edited in memory, see
+ * annotationSettingsKey().
+ *
+ * @param layer result of page->renderAnnotations(scale, scale)
+ */
+void Document::cacheAnnotations(const Page *page, float scale, const QImage &layer) const
+{
+    {
+        QMutexLocker locker(&pageCacheMutex);
+        if (!pageCache)
+            return;
+    }
+    const QByteArray settings = annotationSettingsKey(d, page->d);
+    if (settings.isEmpty())
+    {
+        return;
+    }
+
+    const QByteArray key = pageKey("annotations", fileHash(), page->d->index, scale, settings);
+    QThreadPool::globalInstance()->start(new PageCacheWriteTask(key, layer));
+}
+
+/**
+ * @brief The file the document was loaded from.
+ */
+QString Document::filePath() const
+{
+    return d->filePath;
+}
+
+/**
+ * @brief Whether the document was edited since it was opened.
+ */
+bool Document::isModified() const
+{
+    fz_context *ctx = d->threadContext();
+    QMutexLocker locker(&d->documentMutex);
+    pdf_document *doc = pdf_specifics(ctx, d->document);
+    return doc && pdf_has_unsaved_changes(ctx, doc);
+}
+
+/**
+ * @brief State of the fz_output used by Document::save().
+ */
+struct SaveOutput
+{
+    QFileDevice *file;
+    SaveProgress *progress;
+    qint64 written;
+    qint64 reported;
+    qint64 expected;
+};
+
+static void writeToSaveFile(fz_context *ctx, void *state, const void *data, size_t n)
+{
+    SaveOutput *output = static_cast<SaveOutput *>(state);
+    if (output->file->write(static_cast<const char *>(data), n) != static_cast<qint64>(n))
+    {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "cannot write file");
+    }
+    output->written += n;
+    // the writer makes many small writes, report every 256 KiB
+    if (output->progress && output->written - output->reported >= (256 << 10))
+    {
+        output->reported = output->written;
+        if (!output->progress->saveProgress(output->written, output->expected))
+            fz_throw(ctx, FZ_ERROR_GENERIC, "saving cancelled");
+    }
+}
+
+static void seekSaveFile(fz_context *ctx, void *state, int64_t offset, int whence)
+{
+    QFileDevice *file = static_cast<SaveOutput *>(state)->file;
+    qint64 position = offset;
+    if (whence == SEEK_CUR)
+        position += file->pos();
+    else if (whence == SEEK_END)
+        position += file->size();
+    if (!file->seek(position))
+    {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "cannot seek in file");
+    }
+}
+
+static int64_t tellSaveFile(fz_context *ctx, void *state)
+{
+    Q_UNUSED(ctx);
+    return static_cast<SaveOutput *>(state)->file->pos();
+}
+
+/**
+ * @brief Write the document with its edits to @p filePath.
+ *
+ * SaveIncremental appends only the changed objects, so saving takes time
+ * in proportion to the edits, not to the document. Saved to the open
+ * file, that is all that is written; saved to another file, the open
+ * file is copied first. Repaired and encrypted documents cannot be saved
+ * incrementally.
+ *
+ * SaveFull writes a new file with unused objects removed and the rest
+ * renumbered and compressed, through a temporary file that replaces
+ * @p filePath only on success. The open file cannot be rewritten this
+ * way, MuPDF still reads from it.
+ *
+ * The document is locked meanwhile, call it from a worker thread with a
+ * ThreadScope for large documents.
+ *
+ * @return false on errors or when cancelled, see errorString()
+ */
+bool Document::save(const QString &filePath, SaveMode mode, SaveProgress *progress)
+{
+    TRACE_SPAN("io", "Document::save");
+    fz_context *ctx = d->threadContext();
+    QMutexLocker locker(&d->documentMutex);
+    d->error.clear();
+
+    pdf_document *doc = pdf_specifics(ctx, d->document);
+    if (!doc)
+    {
+        d->error = QStringLiteral("only PDF documents can be saved");
+        return false;
+    }
+    const bool openFile = (QFileInfo(filePath) == QFileInfo(d->filePath));
+    if (mode == SaveFull && openFile)
+    {
+        d->error = QStringLiteral("the open file cannot be rewritten, save to another file");
+        return false;
+    }
+    if (mode == SaveIncremental && !pdf_can_be_saved_incrementally(ctx, doc))
+    {
+        d->error = QStringLiteral("the document was repaired or is encrypted, save a full copy");
+        return false;
+    }
+    if (mode == SaveIncremental && openFile && !pdf_has_unsaved_changes(ctx, doc))
+    {
+        return true;
+    }
+
+    // incremental: append to the file, full: write a temporary file
+    QFile appendFile(filePath);
+    QSaveFile saveFile(filePath);
+    QFileDevice *file = &saveFile;
+    qint64 originalSize = 0;
+    if (mode == SaveIncremental)
+    {
+        if (!openFile && ((QFile::exists(filePath) && !QFile::remove(filePath))
+                          || !QFile::copy(d->filePath, filePath)))
+        {
+            d->error = QStringLiteral("cannot copy the document to %1").arg(filePath);
+            return false;
+        }
+        file = &appendFile;
+        if (!appendFile.open(QIODevice::ReadWrite))
+        {
+            d->error = appendFile.errorString();
+            return false;
+        }
+        originalSize = appendFile.size();
+        appendFile.seek(originalSize);
+    }
+    else if (!saveFile.open(QIODevice::WriteOnly))
+    {
+        d->error = saveFile.errorString();
+        return false;
+    }
+
+    SaveOutput output;
+    output.file = file;
+    output.progress = progress;
+    output.written = 0;
+    output.reported = 0;
+    output.expected = (mode == SaveFull) ? QFileInfo(d->filePath).size() : 0;
+
+    pdf_write_options options;
+    memset(&options, 0, sizeof(options));
+    options.do_incremental = (mode == SaveIncremental) ? 1 : 0;
+    if (mode == SaveFull)
+    {
+        options.do_garbage = 2;     // collect and renumber
+        options.do_compress = 1;
+    }
+
+    bool ok = true;
+    fz_output *out = NULL;
+    fz_var(out);
+    fz_try(ctx)
+    {
+        out = fz_new_output(ctx, &output, writeToSaveFile, NULL, NULL);
+        // the incremental writer needs file offsets
+        out->seek = seekSaveFile;
+        out->tell = tellSaveFile;
+        pdf_write_document(ctx, doc, out, &options);
+        fz_close_output(ctx, out);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_output(ctx, out);
+    }
+    fz_catch(ctx)
+    {
+        d->error = QString::fromUtf8(fz_caught_message(ctx));
+        ok = false;
+    }
+
+    if (mode == SaveIncremental)
+    {
+        ok = ok && appendFile.flush();
+        if (!ok)
+        {
+            // drop a partial update, the file stays as it was
+            if (d->error.isEmpty())
+                d->error = appendFile.errorString();
+            appendFile.resize(originalSize);
+        }
+        appendFile.close();
+        if (!ok && !openFile)
+            QFile::remove(filePath);
+    }
+    else if (ok && !saveFile.commit())
+    {
+        d->error = saveFile.errorString();
+        ok = false;
+    }
+    if (ok && progress)
+    {
+        progress->saveProgress(output.written, output.expected);
+    }
+    return ok;
+}
+
+/**
+ * @brief Why the last save() or exportText() failed.
+ */
+QString Document::errorString() const
+{
+    QMutexLocker locker(&d->documentMutex);
+    return d->error;
+}
+
+/**
+ * @brief State shared by the workers of Document::streamPages().
+ */
+struct PageStream
+{
+    Document *document;
+    PageSink *sink;
+    int pageCount;
+    int window;             // pages encoded but not written yet, at most
+    QMutex mutex;
+    QWaitCondition changed;
+    int nextPage;           // next page to claim
+    int nextWrite;          // next page for PageSink::writePage()
+    QMap<int, QByteArray> encoded;
+    bool stopped;
+};
+
+/**
+ * @brief Claims pages one after another until all are taken.
+ */
+class PageStreamTask : public QRunnable
+{
+public:
+    explicit PageStreamTask(PageStream *stream)
+        : m_stream(stream)
+    {
+    }
+
+    void run()
+    {
+        ThreadScope scope(m_stream->document);
+        forever
+        {
+            int index;
+            {
+                QMutexLocker locker(&m_stream->mutex);
+                while (!m_stream->stopped && m_stream->nextPage < m_stream->pageCount
+                       && m_stream->nextPage - m_stream->nextWrite >= m_stream->window)
+                {
+                    m_stream->changed.wait(&m_stream->mutex);
+                }
+                if (m_stream->stopped || m_stream->nextPage >= m_stream->pageCount)
+                    return;
+                index = m_stream->nextPage++;
+            }
+
+            TRACE_SPAN("text", "PageStream encode");
+            Page *page = m_stream->document->page(index);
+            const QByteArray data = m_stream->sink->encodePage(index, page);
+            delete page;
+
+            QMutexLocker locker(&m_stream->mutex);
+            m_stream->encoded.insert(index, data);
+            m_stream->changed.wakeAll();
+        }
+    }
+
+private:
+    PageStream *m_stream;
+};
+
+/**
+ * @brief Feed every page through @p sink, several pages at once, with
+ * the output in page order.
+ *
+ * Worker threads load pages and call PageSink::encodePage(); the calling
+ * thread writes the results in order as soon as the next page is ready.
+ * Only a few pages per worker are in flight, so memory does not grow
+ * with the document. Interpreting page contents is serialized by the
+ * document lock; extraction from the display lists and encoding run in
+ * parallel.
+ *
+ * @param threadCount workers, 0 for one per core
+ *
+ * @return false if the sink stopped early
+ */
+bool Document::streamPages(PageSink *sink, int threadCount)
+{
+    TRACE_SPAN("text", "Document::streamPages");
+    if (threadCount <= 0)
+        threadCount = QThread::idealThreadCount();
+
+    PageStream stream;
+    stream.document = this;
+    stream.sink = sink;
+    stream.pageCount = qMax(0, numPages());
+    stream.window = 2 * threadCount;
+    stream.nextPage = 0;
+    stream.nextWrite = 0;
+    stream.stopped = false;
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threadCount);
+    for (int i = 0; i < threadCount && i < stream.pageCount; ++i)
+    {
+        pool.start(new PageStreamTask(&stream));
+    }
+
+    bool ok = true;
+    for (int index = 0; index < stream.pageCount && ok; ++index)
+    {
+        QByteArray data;
+        {
+            QMutexLocker locker(&stream.mutex);
+            while (!stream.encoded.contains(index))
+            {
+                stream.changed.wait(&stream.mutex);
+            }
+            data = stream.encoded.take(index);
+            stream.nextWrite = index + 1;
+            stream.changed.wakeAll();
+        }
+        ok = sink->writePage(index, data);
+    }
+
+    {
+        QMutexLocker locker(&stream.mutex);
+        stream.stopped = true;
+        stream.changed.wakeAll();
+    }
+    pool.waitForDone();
+    return ok;
+}
+
+/**
+ * @brief Document header or trailer around the pages of exportText().
+ */
+static QByteArray textFrame(fz_context *ctx, TextFormat format, bool header)
+{
+    if (format == PlainText)
+        return QByteArray();
+    if (format == XmlText)
+        return header ? QByteArray("<?xml version=\"1.0\"?>\n<document>\n") : QByteArray("</document>\n");
+
+    QByteArray data;
+    fz_buffer *buffer = NULL;
+    fz_output *out = NULL;
+    fz_var(buffer);
+    fz_var(out);
+    fz_try(ctx)
+    {
+        buffer = fz_new_buffer(ctx, 1024);
+        out = fz_new_output_with_buffer(ctx, buffer);
+        if (format == HtmlText)
+        {
+            if (header)
+                fz_print_stext_header_as_html(ctx, out);
+            else
+                fz_print_stext_trailer_as_html(ctx, out);
+        }
+        else
+        {
+            if (header)
+                fz_print_stext_header_as_xhtml(ctx, out);
+            else
+                fz_print_stext_trailer_as_xhtml(ctx, out);
+        }
+        fz_close_output(ctx, out);
+
+        unsigned char *bytes = NULL;
+        size_t size = fz_buffer_storage(ctx, buffer, &bytes);
+        data = QByteArray(reinterpret_cast<const char *>(bytes), int(size));
+    }
+    fz_always(ctx)
+    {
+        fz_drop_output(ctx, out);
+        fz_drop_buffer(ctx, buffer);
+    }
+    fz_catch(ctx)
+    {
+        return QByteArray();
+    }
+    return data;
+}
+
+/**
+ * @brief Prints the pages of exportText() and writes them to the device.
+ */
+class TextExportSink : public PageSink
+{
+public:
+    TextExportSink(QIODevice *device, TextFormat format, SaveProgress *progress, int pageCount)
+        : device(device)
+        , format(format)
+        , progress(progress)
+        , pageCount(pageCount)
+    {
+    }
+
+    QByteArray encodePage(int index, const Page *page)
+    {
+        bool ok = false;
+        const QByteArray data = page ? page->exportText(format, &ok) : QByteArray();
+        if (!ok)
+        {
+            QMutexLocker locker(&failedMutex);
+            failedPages.insert(index);
+        }
+        return data;
+    }
+
+    bool writePage(int index, const QByteArray &data)
+    {
+        {
+            // stop rather than leave the page out of the file
+            QMutexLocker locker(&failedMutex);
+            if (failedPages.contains(index))
+            {
+                error = QString("cannot extract the text of page %1").arg(index + 1);
+                return false;
+            }
+        }
+        if (device->write(data) != data.size())
+        {
+            error = device->errorString();
+            return false;
+        }
+        return !progress || progress->saveProgress(index + 1, pageCount);
+    }
+
+    QIODevice *device;
+    TextFormat format;
+    SaveProgress *progress;
+    int pageCount;
+    QString error;
+    QMutex failedMutex;
+    QSet<int> failedPages;  // pages that could not be loaded or extracted
+};
+
+/**
+ * @brief Write the text of the whole document to @p device in @p format.
+ *
+ * Pages are extracted on @p threadCount workers and written in page
+ * order through streamPages(), so even very long documents keep only a
+ * few pages in memory. Plain text pages end with a form feed.
+ *
+ * @param progress reports pages written of the page count, may cancel
+ *
+ * @return false if a page could not be extracted or writing failed (see
+ *         errorString()), or if it was cancelled; @p device then holds
+ *         an incomplete document
+ */
+bool Document::exportText(QIODevice *device, TextFormat format, SaveProgress *progress, int threadCount)
+{
+    TRACE_SPAN("text", "Document::exportText");
+    fz_context *ctx = d->threadContext();
+    {
+        QMutexLocker locker(&d->documentMutex);
+        d->error.clear();
+    }
+
+    TextExportSink sink(device, format, progress, qMax(0, numPages()));
+    const QByteArray header = textFrame(ctx, format, true);
+    bool ok = device->write(header) == header.size();
+    if (!ok)
+        sink.error = device->errorString();
+    if (ok)
+        ok = streamPages(&sink, threadCount);
+    if (ok)
+    {
+        const QByteArray trailer = textFrame(ctx, format, false);
+        ok = device->write(trailer) == trailer.size();
+        if (!ok)
+            sink.error = device->errorString();
+    }
+
+    if (!sink.error.isEmpty())
+    {
+        QMutexLocker locker(&d->documentMutex);
+        d->error = sink.error;
+    }
+    return ok;
+}
+
+/**
+ * @brief Hash identifying the file content, for cache keys.
+ *
+ * Computed once from the file size, its modification time and its first
+ * and last 64 KiB, which is cheap for large files. The modification time
+ * catches rewrites that keep the size and only touch the middle.
+ */
+QByteArray Document::fileHash() const
+{
+    QMutexLocker locker(&d->documentMutex);
+    if (d->fileHash.isEmpty())
+    {
+        const qint64 chunk = 64 * 1024;
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        QFile file(d->filePath);
+        if (file.open(QIODevice::ReadOnly))
+        {
+            const qint64 size = file.size();
+            hash.addData(QByteArray::number(size));
+            hash.addData(QByteArray::number(QFileInfo(file).lastModified().toMSecsSinceEpoch()));
+            hash.addData(file.read(chunk));
+            if (size > chunk && file.seek(qMax(chunk, size - chunk)))
+            {
+                hash.addData(file.read(chunk));
+            }
+        }
+        else
+        {
+            hash.addData(d->filePath.toUtf8());
+        }
+        d->fileHash = hash.result();
+    }
+    return d->fileHash;
+}
+
 /**
  * @brief PDF version number, for example: 1.7
  */
@@ -235,6 +1393,7 @@ QDateTime Document::modDate() const
  */
 void Document::setTransparentRendering(bool enable)
 {
+    QMutexLocker locker(&d->documentMutex);
     d->transparent = enable;
 }
 
@@ -254,14 +1413,75 @@ void Document::setTransparentRendering(bool enable)
  */
 void Document::setBackgroundColor(int r, int g, int b, int a)
 {
+    QMutexLocker locker(&d->documentMutex);
     d->r = r;
     d->g = g;
     d->b = b;
     d->a = a;
 }
 
+/**
+ * @brief Choose the pixel format of rendered images for all pages.
+ * For particular page setting, use Page::setRenderMode() instead.
+ *
+ * Gray and mono modes take 1/4 and 1/32 of the memory of color output.
+ * They are only used for opaque pages with a gray background and without
+ * Sepia or Tint effects; other pages still render in color.
+ *
+ * @param mode RenderColor(default), RenderAuto, RenderGray or RenderMono
+ */
+void Document::setRenderMode(RenderMode mode)
+{
+    QMutexLocker locker(&d->documentMutex);
+    d->renderMode = mode;
+}
+
+/**
+ * @brief Set color post-processing for all pages.
+ * For particular page setting, use Page::setColorEffect() instead.
+ *
+ * The effect is applied to the rendered image on the rendering thread,
+ * background included; the file is not changed.
+ *
+ * @param effect NoEffect(default), InvertColors, Grayscale, Sepia or Tint
+ */
+void Document::setColorEffect(ColorEffect effect)
+{
+    QMutexLocker locker(&d->documentMutex);
+    d->effect = effect;
+}
+
+/**
+ * @brief Set the color white is mapped to by the Tint effect.
+ * This function modify global setting of all pages.
+ */
+void Document::setTintColor(int r, int g, int b)
+{
+    QMutexLocker locker(&d->documentMutex);
+    d->tintR = r;
+    d->tintG = g;
+    d->tintB = b;
+}
+
+/**
+ * @brief Set gamma correction for all pages, applied before the color
+ * effect. Values above 1 make thin text heavier.
+ *
+ * @param gamma 1.0f(default) disables the correction
+ */
+void Document::setGamma(float gamma)
+{
+    QMutexLocker locker(&d->documentMutex);
+    d->gamma = gamma;
+}
+
 DocumentPrivate::~DocumentPrivate()
 {
+    {
+        QMutexLocker locker(&documentsMutex);
+        documents.removeAll(this);
+    }
+
     foreach (PagePrivate *pagep, pages)
     {
         pagep->deleteData();
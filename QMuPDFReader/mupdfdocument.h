@@ -5,14 +5,103 @@
 
 class QString;
 class QDateTime;
+class QImage;
+class QIODevice;
+class QSize;
 
 namespace MuPDF
 {
 class Document;
 class DocumentPrivate;
 class Page;
+class ThreadScope;
 
 Document * loadDocument(const QString &filePath);
+void setThumbnailCache(const QString &directory, qint64 maximumSize = 64 << 20);
+void setPageCache(const QString &directory, qint64 maximumSize = 512 << 20);
+void setSharedContext(bool enable, qint64 storeSize = 256 << 20);
+qint64 allocatedMemory();
+qint64 releaseMemory(qint64 bytes);
+
+/**
+ * @brief Color post-processing applied to rendered pages.
+ */
+enum ColorEffect
+{
+    NoEffect,
+    InvertColors,   // night reading mode
+    Grayscale,
+    Sepia,
+    Tint            // luma mapped onto the tint color, see setTintColor()
+};
+
+/**
+ * @brief Pixel format of rendered pages.
+ */
+enum RenderMode
+{
+    RenderColor,    // 32-bit, see Page::renderRegion()
+    RenderAuto,     // 8-bit gray for pages without color, 32-bit otherwise
+    RenderGray,     // always 8-bit gray (QImage::Format_Grayscale8)
+    RenderMono      // 1-bit halftoned (QImage::Format_Mono), e.g. thumbnails
+};
+
+/**
+ * @brief How Document::save() writes the file.
+ */
+enum SaveMode
+{
+    SaveIncremental,    // append the changed objects, the file is not rewritten
+    SaveFull            // rewrite everything, with garbage collection
+};
+
+/**
+ * @brief Output format of Document::exportText() and Page::exportText().
+ */
+enum TextFormat
+{
+    PlainText,      // UTF-8 text, one line per text line
+    HtmlText,       // HTML keeping the visual layout (positioned lines)
+    XhtmlText,      // semantic XHTML (paragraphs, images)
+    XmlText         // every character with its font and quad
+};
+
+/**
+ * @brief Receives the progress of Document::save() on the saving thread.
+ */
+class SaveProgress
+{
+public:
+    virtual ~SaveProgress() {}
+    /**
+     * @param written bytes written so far
+     * @param expected estimated total, 0 if unknown (incremental saves)
+     *
+     * @return false to cancel saving
+     */
+    virtual bool saveProgress(qint64 written, qint64 expected) = 0;
+};
+
+/**
+ * @brief Receives the pages of Document::streamPages().
+ *
+ * encodePage() runs on worker threads in any order and turns a page into
+ * output bytes; writePage() gets the results in page order on the thread
+ * that called streamPages().
+ */
+class PageSink
+{
+public:
+    virtual ~PageSink() {}
+    /**
+     * @param page loaded page, NULL if it could not be loaded
+     */
+    virtual QByteArray encodePage(int index, const Page *page) = 0;
+    /**
+     * @return false to stop
+     */
+    virtual bool writePage(int index, const QByteArray &data) = 0;
+};
 
 class Document
 {
@@ -21,7 +110,19 @@ public:
     bool needsPassword() const;
     bool authPassword(const QString &password);
     int numPages() const;
-    Page * page(int index) const;
+    Page * page(int index, bool displayList = true) const;
+    QImage thumbnail(int index, const QSize &size, RenderMode mode = RenderColor) const;
+    QImage cachedPage(int index, float scale) const;
+    void cachePage(const Page *page, float scale, const QImage &image) const;
+    bool cachedAnnotations(int index, float scale, QImage *layer) const;
+    void cacheAnnotations(const Page *page, float scale, const QImage &layer) const;
+    QByteArray fileHash() const;
+    QString filePath() const;
+    bool isModified() const;
+    bool save(const QString &filePath, SaveMode mode = SaveIncremental, SaveProgress *progress = NULL);
+    QString errorString() const;
+    bool streamPages(PageSink *sink, int threadCount = 0);
+    bool exportText(QIODevice *device, TextFormat format, SaveProgress *progress = NULL, int threadCount = 0);
 
     QString pdfVersion() const;
     QString title() const;
@@ -34,6 +135,10 @@ public:
     QDateTime modDate() const;
     void setTransparentRendering(bool enable);
     void setBackgroundColor(int r, int g, int b, int a = 255);
+    void setColorEffect(ColorEffect effect);
+    void setTintColor(int r, int g, int b);
+    void setGamma(float gamma);
+    void setRenderMode(RenderMode mode);
 
 private:
     Document(DocumentPrivate *documentp)
@@ -45,9 +150,42 @@ private:
     Document(const Document &);
     Document &operator=(const Document &);
 
+    Page * loadPage(int index, bool buildDisplayList) const;
+
     DocumentPrivate *d;
 
 friend Document *loadDocument(const QString &filePath);
+friend class ThreadScope;
+friend class Spooler;
+};
+
+/**
+ * @brief Gives the current thread its own MuPDF context for a document.
+ *
+ * A MuPDF context must not be used by two threads at the same time. The
+ * thread that loaded the document uses the document's own context; any
+ * other thread has to keep a ThreadScope alive while it calls into the
+ * document or its pages. Clones share the resource store of the document,
+ * so fonts and images decoded by one thread are reused by the others.
+ *
+ * @note Create it on the stack of the worker thread, never share it.
+ */
+class ThreadScope
+{
+public:
+    explicit ThreadScope(Document *document);
+    ~ThreadScope();
+
+private:
+    // disable copy
+    ThreadScope(const ThreadScope &);
+    ThreadScope &operator=(const ThreadScope &);
+
+    DocumentPrivate *d;
+    void *context;
+    ThreadScope *previous;
+
+friend class DocumentPrivate;
 };
 
 } // end namespace MuPDF
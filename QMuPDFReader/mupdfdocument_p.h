@@ -3,8 +3,12 @@
 
 #include "fitz.h"
 #include "pdf.h"
+#include "mupdfdocument.h"
 
+#include <QByteArray>
+#include <QHash>
 #include <QList>
+#include <QMutex>
 #include <QString>
 
 namespace MuPDF
@@ -18,6 +22,11 @@ public:
     DocumentPrivate(const QString &filePath);
     ~DocumentPrivate();
 
+    fz_context *threadContext() const;
+    QByteArray settingsKey() const;
+    static void lockMutex(void *user, int lock);
+    static void unlockMutex(void *user, int lock);
+
     void deleteData()
     {
         if (document)
@@ -48,17 +57,37 @@ public:
             return QString();
         char *str = pdf_to_utf8(context, obj);
         QString ret = QString::fromUtf8(str);
-        free(str);
+        fz_free(context, str);
         return ret;
     }
 
     fz_context *context;
     fz_document *document;
+    QString filePath;
+    QByteArray fileHash; // see Document::fileHash()
     bool transparent;
     int b, g, r, a; // background color
+    ColorEffect effect;
+    int tintR, tintG, tintB;
+    float gamma;
+    RenderMode renderMode;
+    // page index -> whether the page has color, see PagePrivate::hasColor()
+    QHash<int, bool> colorPages;
+    // edits since the document was opened, see annotationSettingsKey()
+    int editCount;
+    QString error;  // see Document::errorString()
     
     // children
     QList<PagePrivate *> pages;
+
+    // locks shared by the context and its per-thread clones; unused when
+    // the context is a clone of the shared one, see setSharedContext()
+    QMutex mutexes[FZ_LOCK_MAX];
+    fz_locks_context locks;
+    // fz_document and fz_page may only be used by one thread at a time,
+    // display lists can be run from several threads at once; also guards
+    // the render settings above, which pages copy when they are loaded
+    QMutex documentMutex;
 };
 
 }
@@ -2,38 +2,67 @@
 #include "mupdfpage_p.h"
 #include "mupdfdocument.h"
 #include "mupdfdocument_p.h"
+#include "pixelkernels.h"
+#include "tracing.h"
 #include "fitz.h"
 
 #include <QImage>
+#include <QRect>
+#include <QTransform>
+#include <QRgb>
+#include <QVector>
 #include <QSizeF>
+#include <QString>
 #include <QDebug>
 
-static void clear_rgb_samples_with_value(
-        unsigned char *samples, int size,
-        int b, int g, int r, int a)
+/**
+ * @brief Colorspace whose byte order matches the 32-bit QImage formats.
+ *
+ * QImage::Format_ARGB32_Premultiplied and Format_RGB32 store 0xAARRGGBB
+ * words, i.e. B, G, R, A bytes on little endian machines. MuPDF pixmaps
+ * with alpha are premultiplied as well, so the draw device can write the
+ * QImage buffer directly and QPainter only has to blit it.
+ */
+static inline fz_colorspace *imageColorspace(fz_context *ctx)
 {
-    int i = 0;
-
-    while (i < size)
-    {
-        *(samples + i++) = r;
-        *(samples + i++) = g;
-        *(samples + i++) = b;
-        *(samples + i++) = a;
-    }
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    return fz_device_bgr(ctx);
+#else
+    return fz_device_rgb(ctx);
+#endif
 }
 
 /**
- * @brief Clean up image data when the last copy of the QImage is destoryed.
+ * @brief Drops a cloned context on every return path.
  */
-static inline void imageCleanupHandler(void *data)
+class ContextGuard
 {
-    unsigned char *samples = static_cast<unsigned char *>(data);
+public:
+    explicit ContextGuard(fz_context *ctx)
+        : context(ctx)
+    {
+    }
 
-    if (samples)
+    ~ContextGuard()
     {
-        delete []samples;
+        fz_drop_context(context);
     }
+
+    fz_context *context;
+};
+
+static inline QImage::Format imageFormat(bool opaque)
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    return opaque ? QImage::Format_RGB32 : QImage::Format_ARGB32_Premultiplied;
+#else
+    return opaque ? QImage::Format_RGBX8888 : QImage::Format_RGBA8888_Premultiplied;
+#endif
+}
+
+static QRectF toRectF(const fz_rect &rect)
+{
+    return QRectF(rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0);
 }
 
 namespace MuPDF
@@ -45,28 +74,61 @@ Page::~Page()
     d = NULL;
 }
 
-PagePrivate::PagePrivate(DocumentPrivate *dp, int index)
+/**
+ * @param buildDisplayList false for pages that are rendered once, e.g.
+ *        thumbnails; they run the page contents directly instead
+ */
+PagePrivate::PagePrivate(DocumentPrivate *dp, int index, bool buildDisplayList)
     : documentp(dp)
-    , context(documentp->context)
     , document(documentp->document)
     , page(NULL)
     , display_list(NULL)
-    , transparent(documentp->transparent)
-    , b(documentp->b), g(documentp->g), r(documentp->r), a(documentp->a)
+    , annotationsLoaded(false)
+    , textLoaded(false)
+    , linksLoaded(false)
+    , bounds(fz_empty_rect)
+    , aaLevel(-1)
+    , showAnnotations(false)
+    , index(index)
 {
+    fz_context *context = documentp->threadContext();
+    QMutexLocker locker(&documentp->documentMutex);
+
+    // the document settings and their cache key, consistent with each other
+    transparent = documentp->transparent;
+    b = documentp->b;
+    g = documentp->g;
+    r = documentp->r;
+    a = documentp->a;
+    effect = documentp->effect;
+    tintR = documentp->tintR;
+    tintG = documentp->tintG;
+    tintB = documentp->tintB;
+    gamma = documentp->gamma;
+    renderMode = documentp->renderMode;
+    settingsKey = documentp->settingsKey();
+
     fz_try(context)
     {
         fz_device *list_device;
+        qint64 traceBegin = TRACE_TIMESTAMP();
 
         // load page
         page = fz_load_page(context, document, index);
+        fz_bound_page(context, page, &bounds);
+        TRACE_SPAN_SINCE("render", "fz_load_page", traceBegin);
 
         // display list
-        display_list = fz_new_display_list(context, NULL);
-        list_device = fz_new_list_device(context, display_list);
-        fz_run_page_contents(context, page, list_device, &fz_identity, NULL);
-        fz_close_device(context, list_device);
-        fz_drop_device(context, list_device);
+        if (buildDisplayList)
+        {
+            traceBegin = TRACE_TIMESTAMP();
+            display_list = fz_new_display_list(context, NULL);
+            list_device = fz_new_list_device(context, display_list);
+            fz_run_page_contents(context, page, list_device, &fz_identity, NULL);
+            fz_close_device(context, list_device);
+            fz_drop_device(context, list_device);
+            TRACE_SPAN_SINCE("render", "Page display list", traceBegin);
+        }
     }
     fz_catch(context)
     {
@@ -85,6 +147,9 @@ bool Page::isValid() const
 /**
  * @brief Render page to QImage
  *
+ * Annotations are left out unless setShowAnnotations() is on; viewers
+ * draw them as a separate layer, see renderAnnotations().
+ *
  * @param scaleX scale for X direction
  *               (Default value: 1.0f; >1.0f: zoom in; <1.0f: zoom out)
  * @param scaleY scale for Y direction
@@ -95,92 +160,938 @@ bool Page::isValid() const
  */
 QImage Page::renderImage(float scaleX, float scaleY, float rotation) const
 {
-    fz_pixmap *pixmap = NULL;
-    unsigned char *samples = NULL;
-    unsigned char *copyed_samples = NULL;
-    int width = 0;
-    int height = 0;
-    int size = 0;
-
-    fz_rect mediabox;
-    fz_stext_page * text_page = fz_new_stext_page(d->context, fz_bound_page(d->context, d->page, &mediabox));
-
-    fz_device *tdev;
-    tdev = fz_new_stext_device(d->context, text_page, NULL);
-    fz_run_display_list(d->context, d->display_list, tdev, &fz_identity, &fz_infinite_rect, NULL);
-    fz_close_device(d->context, tdev);
-    fz_drop_device(d->context, tdev);
+    return renderRegion(QRect(), scaleX, scaleY, rotation);
+}
 
+/**
+ * @brief Render part of the page to QImage
+ *
+ * Large outputs (e.g. printing) can be rasterized band by band this way,
+ * without ever holding the whole page in memory.
+ *
+ * @param region area to render, in pixels of the scaled and rotated page
+ *               whose top left corner is (0, 0). A null rect renders
+ *               the whole page.
+ * @param scaleX scale for X direction
+ * @param scaleY scale for Y direction
+ * @param rotation degree of clockwise rotation (Range: [0.0f, 360.0f))
+ *
+ * @return Format_RGB32 for opaque pages, Format_ARGB32_Premultiplied for
+ * transparent ones, so painting is a plain blit; Format_Grayscale8 or
+ * Format_Mono depending on setRenderMode(). This function will return
+ * a empty QImage if failed or if region lies outside the page.
+ */
+QImage Page::renderRegion(const QRect &region, float scaleX, float scaleY, float rotation) const
+{
     // build transform matrix
     fz_matrix transform;
     fz_pre_rotate(fz_scale(&transform, scaleX, scaleY), rotation);
 
     // get transformed page size
-    fz_rect bounds;
+    fz_rect bounds = d->bounds;
     fz_irect bbox;
-    fz_bound_page(d->context, d->page, &bounds);
     fz_round_rect(&bbox, fz_transform_rect(&bounds, &transform));
-    fz_rect_from_irect(&bounds, &bbox);
 
-    // render to pixmap
+    // clip to the requested region
+    if (!region.isNull())
+    {
+        fz_irect clip;
+        clip.x0 = bbox.x0 + region.left();
+        clip.y0 = bbox.y0 + region.top();
+        clip.x1 = clip.x0 + region.width();
+        clip.y1 = clip.y0 + region.height();
+        fz_intersect_irect(&bbox, &clip);
+        if (fz_is_empty_irect(&bbox))
+        {
+            return QImage();
+        }
+    }
+
+    // gray output needs an opaque gray background and no tinting
+    const bool customBackground = (d->b >= 0 && d->g >= 0 && d->r >= 0 && d->a >= 0);
+    const bool opaque = !d->transparent && (!customBackground || d->a >= 255);
+    bool gray = false;
+    if (opaque && d->effect != Sepia && d->effect != Tint
+            && (!customBackground || (d->r == d->g && d->g == d->b)))
+    {
+        gray = (d->renderMode == RenderGray || d->renderMode == RenderMono
+                || (d->renderMode == RenderAuto && !d->hasColor()));
+    }
+    const bool mono = gray && d->renderMode == RenderMono;
+
+    // the QImage owns the samples, the pixmap only borrows them
+    const int width = bbox.x1 - bbox.x0;
+    const int height = bbox.y1 - bbox.y0;
+    QImage image(width, height, gray ? QImage::Format_Grayscale8 : imageFormat(opaque));
+    if (image.isNull())
+    {
+        return image;
+    }
+    fz_bitmap *bitmap = NULL;
+    if (!d->draw(transform, bbox, image.bits(), image.bytesPerLine(), gray, !opaque, mono ? &bitmap : NULL))
+    {
+        return QImage();
+    }
+
+    if (bitmap)
+    {
+        QImage monoImage(width, height, QImage::Format_Mono);
+        if (!monoImage.isNull())
+        {
+            QVector<QRgb> colors;
+            colors << qRgb(255, 255, 255) << qRgb(0, 0, 0);
+            monoImage.setColorTable(colors);
+            const int rowBytes = qMin(bitmap->stride, monoImage.bytesPerLine());
+            for (int y = 0; y < height; ++y)
+            {
+                memcpy(monoImage.scanLine(y), bitmap->samples + size_t(y) * bitmap->stride, rowBytes);
+            }
+        }
+        fz_drop_bitmap(d->documentp->threadContext(), bitmap);
+        return monoImage;
+    }
+    return image;
+}
+
+/**
+ * @brief Render part of the page into a buffer owned by the caller.
+ *
+ * The draw device writes straight into @p buffer, so tile renderers and
+ * band printers can reuse their buffers (see ImagePool) instead of
+ * allocating an image per call. Parts of @p region outside the page get
+ * the background color.
+ *
+ * @param buffer region.width() x region.height() pixels
+ * @param bytesPerLine stride of @p buffer
+ * @param format Format_RGB32, Format_ARGB32_Premultiplied (keeps
+ *               transparency, see setTransparentRendering()) or
+ *               Format_Grayscale8; setRenderMode() does not apply
+ * @param region area to render, in pixels of the transformed page whose
+ *               top left corner is (0, 0)
+ * @param matrix page transform in points, e.g. QTransform().scale(2, 2)
+ *
+ * @return false if rendering failed or the arguments are not supported
+ */
+bool Page::renderTo(uchar *buffer, int bytesPerLine, QImage::Format format,
+                    const QRect &region, const QTransform &matrix) const
+{
+    const bool gray = (format == QImage::Format_Grayscale8);
+    const bool alpha = (format == imageFormat(false));
+    if (!buffer || region.isEmpty() || (!gray && !alpha && format != imageFormat(true))
+            || bytesPerLine < region.width() * (gray ? 1 : 4))
+    {
+        return false;
+    }
+
+    fz_matrix transform;
+    transform.a = float(matrix.m11());
+    transform.b = float(matrix.m12());
+    transform.c = float(matrix.m21());
+    transform.d = float(matrix.m22());
+    transform.e = float(matrix.dx());
+    transform.f = float(matrix.dy());
+
+    fz_rect bounds = d->bounds;
+    fz_irect pageBox;
+    fz_round_rect(&pageBox, fz_transform_rect(&bounds, &transform));
+    fz_irect bbox;
+    bbox.x0 = pageBox.x0 + region.left();
+    bbox.y0 = pageBox.y0 + region.top();
+    bbox.x1 = bbox.x0 + region.width();
+    bbox.y1 = bbox.y0 + region.height();
+    return d->draw(transform, bbox, buffer, bytesPerLine, gray, alpha, NULL);
+}
+
+/**
+ * @brief Render the annotations of the page (notes, highlights, form
+ * fields, ...) as a transparent layer of the size renderImage() gives.
+ *
+ * Page images do not contain annotations; compositing this layer on top
+ * lets viewers show, hide or update annotations without rendering the
+ * page contents again. Color effect and gamma apply as for the page.
+ *
+ * @return a null image if the page has no annotations or rendering failed
+ */
+QImage Page::renderAnnotations(float scaleX, float scaleY, float rotation) const
+{
+    if (!d->loadAnnotations())
+    {
+        return QImage();
+    }
+
+    fz_matrix transform;
+    fz_pre_rotate(fz_scale(&transform, scaleX, scaleY), rotation);
+    fz_rect bounds = d->bounds;
+    fz_irect bbox;
+    fz_round_rect(&bbox, fz_transform_rect(&bounds, &transform));
+
+    QImage image(bbox.x1 - bbox.x0, bbox.y1 - bbox.y0, imageFormat(false));
+    if (image.isNull()
+            || !d->draw(transform, bbox, image.bits(), image.bytesPerLine(), false, true, NULL, true))
+    {
+        return QImage();
+    }
+    return image;
+}
+
+/**
+ * @brief Whether the page has annotations, see renderAnnotations().
+ */
+bool Page::hasAnnotations() const
+{
+    return d->loadAnnotations();
+}
+
+/**
+ * @brief Render the annotations inside @p rect again into @p layer, e.g.
+ * the dirty rects of an edit, see takeDirtyRects(). Only that part of the
+ * layer is cleared and drawn, the draw device is clipped to it.
+ *
+ * @param layer result of renderAnnotations() with the same scale and
+ *              rotation, patched in place
+ * @param rect page area in points
+ *
+ * @return false if @p layer does not match the page or rendering failed
+ */
+bool Page::updateAnnotations(QImage *layer, const QRectF &rect,
+                             float scaleX, float scaleY, float rotation) const
+{
+    fz_matrix transform;
+    fz_pre_rotate(fz_scale(&transform, scaleX, scaleY), rotation);
+    fz_rect bounds = d->bounds;
+    fz_irect bbox;
+    fz_round_rect(&bbox, fz_transform_rect(&bounds, &transform));
+    if (!layer || layer->format() != imageFormat(false)
+            || layer->size() != QSize(bbox.x1 - bbox.x0, bbox.y1 - bbox.y0))
+    {
+        return false;
+    }
+
+    fz_rect area = { float(rect.left()), float(rect.top()), float(rect.right()), float(rect.bottom()) };
+    fz_irect clip;
+    fz_round_rect(&clip, fz_transform_rect(&area, &transform));
+    fz_intersect_irect(&clip, &bbox);
+    if (fz_is_empty_irect(&clip))
+    {
+        return true;
+    }
+
+    uchar *samples = layer->bits() + size_t(clip.y0 - bbox.y0) * layer->bytesPerLine()
+            + size_t(clip.x0 - bbox.x0) * 4;
+    if (!d->loadAnnotations())
+    {
+        // the last annotation is gone
+        for (int y = 0; y < clip.y1 - clip.y0; ++y)
+        {
+            memset(samples + size_t(y) * layer->bytesPerLine(), 0, size_t(clip.x1 - clip.x0) * 4);
+        }
+        return true;
+    }
+    return d->draw(transform, clip, samples, layer->bytesPerLine(), false, true, NULL, true);
+}
+
+/**
+ * @brief Bounds of the text form fields of the page in points, in the
+ * order textFieldValue() and setTextFieldValue() count them.
+ *
+ * @return empty for pages without text fields and non-PDF documents
+ */
+QVector<QRectF> Page::textFields() const
+{
+    QVector<QRectF> fields;
+    fz_context *ctx = d->documentp->threadContext();
+    QMutexLocker locker(&d->documentp->documentMutex);
+    pdf_document *doc = pdf_specifics(ctx, d->document);
+    if (!doc || !d->page)
+    {
+        return fields;
+    }
+
+    fz_try(ctx)
+    {
+        pdf_page *page = pdf_page_from_fz_page(ctx, d->page);
+        for (pdf_widget *widget = pdf_first_widget(ctx, doc, page); widget; widget = pdf_next_widget(ctx, widget))
+        {
+            if (pdf_widget_type(ctx, widget) == PDF_WIDGET_TYPE_TEXT)
+            {
+                fz_rect rect;
+                pdf_bound_widget(ctx, widget, &rect);
+                fields.append(QRectF(rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0));
+            }
+        }
+    }
+    fz_catch(ctx)
+    {
+        fields.clear();
+    }
+    return fields;
+}
+
+/**
+ * @brief The text of a text form field.
+ *
+ * @param field index into textFields()
+ */
+QString Page::textFieldValue(int field) const
+{
+    fz_context *ctx = d->documentp->threadContext();
+    QMutexLocker locker(&d->documentp->documentMutex);
+    pdf_document *doc = pdf_specifics(ctx, d->document);
+    if (!doc || !d->page)
+    {
+        return QString();
+    }
+
+    char *text = NULL;
+    fz_var(text);
+    fz_try(ctx)
+    {
+        pdf_widget *widget = d->textField(ctx, field);
+        if (widget)
+            text = pdf_text_widget_text(ctx, doc, widget);
+    }
+    fz_catch(ctx)
+    {
+        text = NULL;
+    }
+    const QString value = QString::fromUtf8(text);
+    fz_free(ctx, text);
+    return value;
+}
+
+/**
+ * @brief Change the text of a text form field and regenerate its
+ * appearance.
+ *
+ * The areas of all annotations whose appearance changed, including
+ * calculated fields that depend on this one, are added to
+ * takeDirtyRects(), so viewers can patch their annotation layer with
+ * updateAnnotations() instead of rendering the page again. Only those
+ * annotations are recorded again. Page contents are not affected, form
+ * fields are annotations.
+ *
+ * @param field index into textFields()
+ *
+ * @return false if the field does not exist or rejected the text
+ */
+bool Page::setTextFieldValue(int field, const QString &text)
+{
+    fz_context *ctx = d->documentp->threadContext();
+    QMutexLocker locker(&d->documentp->documentMutex);
+    pdf_document *doc = pdf_specifics(ctx, d->document);
+    if (!doc || !d->page)
+    {
+        return false;
+    }
+
+    QByteArray utf8 = text.toUtf8();
+    int accepted = 0;
+    // appearance iteration and bounds of every annotation before the edit;
+    // calculated fields may change other annotations than the edited one
+    QVector<int> iterations;
+    QVector<fz_rect> before;
+    QVector<int> changed;
+    bool reordered = false;
+    fz_var(accepted);
+    fz_var(reordered);
+    fz_try(ctx)
+    {
+        pdf_page *page = pdf_page_from_fz_page(ctx, d->page);
+        pdf_widget *widget = d->textField(ctx, field);
+        if (widget)
+        {
+            for (pdf_annot *annot = pdf_first_annot(ctx, page); annot; annot = pdf_next_annot(ctx, annot))
+            {
+                fz_rect rect;
+                iterations.append(annot->ap_iteration);
+                before.append(*pdf_bound_annot(ctx, annot, &rect));
+            }
+            accepted = pdf_text_widget_set_text(ctx, doc, widget, utf8.data());
+            // regenerates the appearance streams of changed annotations
+            pdf_update_page(ctx, page);
+
+            int i = 0;
+            for (pdf_annot *annot = pdf_first_annot(ctx, page); annot; annot = pdf_next_annot(ctx, annot), ++i)
+            {
+                if (i >= iterations.size())
+                {
+                    reordered = true;
+                    break;
+                }
+                if (annot->ap_iteration != iterations.at(i))
+                {
+                    fz_rect rect;
+                    pdf_bound_annot(ctx, annot, &rect);
+                    fz_union_rect(&rect, &before.at(i));
+                    d->dirtyRects.append(toRectF(rect));
+                    changed.append(i);
+                }
+            }
+            reordered = reordered || i != iterations.size();
+        }
+    }
+    fz_catch(ctx)
+    {
+        accepted = 0;
+    }
+    if (!accepted)
+    {
+        return false;
+    }
+
+    if (reordered)
+    {
+        // annotations were added or removed: everything may have moved
+        d->dirtyRects.append(toRectF(d->bounds));
+        foreach (fz_display_list *list, d->annot_lists)
+        {
+            fz_drop_display_list(ctx, list);
+        }
+        d->annot_lists.clear();
+        d->annotationsLoaded = false;
+    }
+    else if (d->annotationsLoaded && !d->reloadAnnotations(ctx, changed))
+    {
+        // record all of them again on next use
+        d->annotationsLoaded = false;
+    }
+    ++d->documentp->editCount;
+    return true;
+}
+
+/**
+ * @brief Page areas in points changed by edits since the last call.
+ */
+QVector<QRectF> Page::takeDirtyRects()
+{
+    QMutexLocker locker(&d->documentp->documentMutex);
+    QVector<QRectF> rects;
+    rects.swap(d->dirtyRects);
+    return rects;
+}
+
+/**
+ * @brief The @p field th text form field of the page, or NULL.
+ *
+ * @note Throws MuPDF errors, call inside fz_try with the document lock.
+ */
+pdf_widget *PagePrivate::textField(fz_context *ctx, int field)
+{
+    pdf_document *doc = pdf_specifics(ctx, document);
+    pdf_widget *widget = pdf_first_widget(ctx, doc, pdf_page_from_fz_page(ctx, page));
+    for (; widget; widget = pdf_next_widget(ctx, widget))
+    {
+        if (pdf_widget_type(ctx, widget) == PDF_WIDGET_TYPE_TEXT && field-- == 0)
+        {
+            return widget;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Record one annotation into a new display list.
+ *
+ * @note Throws MuPDF errors.
+ */
+static fz_display_list *recordAnnotation(fz_context *ctx, fz_annot *annot)
+{
+    fz_display_list *list = fz_new_display_list(ctx, NULL);
+    fz_device *dev = NULL;
+    fz_var(dev);
+    fz_try(ctx)
+    {
+        dev = fz_new_list_device(ctx, list);
+        fz_run_annot(ctx, annot, dev, &fz_identity, NULL);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx)
+    {
+        fz_drop_display_list(ctx, list);
+        fz_rethrow(ctx);
+    }
+    return list;
+}
+
+/**
+ * @brief Record the annotations into display lists of their own on first
+ * use, so they can be drawn as a separate layer. Each annotation gets a
+ * list, so an edit only records the annotations it changed again, see
+ * reloadAnnotations().
+ *
+ * @return false if the page has no annotations
+ */
+bool PagePrivate::loadAnnotations()
+{
+    fz_context *ctx = documentp->threadContext();
+    QMutexLocker locker(&documentp->documentMutex);
+    if (annotationsLoaded || !page)
+    {
+        return !annot_lists.isEmpty();
+    }
+    annotationsLoaded = true;
+
+    foreach (fz_display_list *list, annot_lists)
+    {
+        fz_drop_display_list(ctx, list);
+    }
+    annot_lists.clear();
+    fz_try(ctx)
+    {
+        for (fz_annot *annot = fz_first_annot(ctx, page); annot; annot = fz_next_annot(ctx, annot))
+        {
+            annot_lists.append(recordAnnotation(ctx, annot));
+        }
+    }
+    fz_catch(ctx)
+    {
+        foreach (fz_display_list *list, annot_lists)
+        {
+            fz_drop_display_list(ctx, list);
+        }
+        annot_lists.clear();
+    }
+    return !annot_lists.isEmpty();
+}
+
+/**
+ * @brief Record the annotations at @p indexes again after an edit; the
+ * others keep their display lists. Call with the document lock.
+ *
+ * @return false if recording failed, the lists are then unchanged
+ */
+bool PagePrivate::reloadAnnotations(fz_context *ctx, const QVector<int> &indexes)
+{
+    QVector<fz_display_list *> lists;
+    fz_try(ctx)
+    {
+        int i = 0;
+        for (fz_annot *annot = fz_first_annot(ctx, page); annot; annot = fz_next_annot(ctx, annot), ++i)
+        {
+            if (indexes.contains(i) && i < annot_lists.size())
+                lists.append(recordAnnotation(ctx, annot));
+        }
+    }
+    fz_catch(ctx)
+    {
+        foreach (fz_display_list *list, lists)
+        {
+            fz_drop_display_list(ctx, list);
+        }
+        return false;
+    }
+
+    int next = 0;
+    foreach (int index, indexes)
+    {
+        if (index < annot_lists.size())
+        {
+            fz_drop_display_list(ctx, annot_lists.at(index));
+            annot_lists[index] = lists.at(next++);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Build the spatial index of the characters on first use, for hit
+ * testing and text selection.
+ *
+ * The characters come from the structured text of the display list, run
+ * without the document lock; only the character codes and lines are kept,
+ * the structured text is dropped again.
+ */
+void PagePrivate::loadText()
+{
+    if (textLoaded)
+    {
+        return;
+    }
+    textLoaded = true;
+    TRACE_SPAN("text", "Page text index");
+
+    fz_context *ctx = documentp->threadContext();
+    fz_stext_page *text = NULL;
     fz_device *dev = NULL;
-    fz_try(d->context)
+    fz_var(text);
+    fz_var(dev);
+    fz_try(ctx)
+    {
+        text = fz_new_stext_page(ctx, &bounds);
+        dev = fz_new_stext_device(ctx, text, NULL);
+        run(ctx, dev, &fz_identity, &fz_infinite_rect);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx)
     {
-        // fz_pixmap will always include a separate alpha channel
-        pixmap = fz_new_pixmap_with_bbox(d->context, fz_device_rgb(d->context), &bbox, NULL, 1);
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx)
+    {
+        fz_drop_stext_page(ctx, text);
+        text = NULL;
+    }
 
-        if (!d->transparent)
+    QVector<QRectF> rects;
+    if (text)
+    {
+        int lineIndex = 0;
+        for (fz_stext_block *block = text->first_block; block; block = block->next)
         {
-            if (d->b >= 0 && d->g >= 0 && d->r >= 0 && d->a >= 0) {
-                // with user defined background color
-                clear_rgb_samples_with_value(samples, size, d->b, d->g, d->r, d->a);
+            if (block->type != FZ_STEXT_BLOCK_TEXT)
+                continue;
+            for (fz_stext_line *line = block->u.t.first_line; line; line = line->next)
+            {
+                for (fz_stext_char *ch = line->first_char; ch; ch = ch->next)
+                {
+                    chars.append(uint(ch->c));
+                    charLines.append(lineIndex);
+                    rects.append(toRectF(ch->bbox));
+                }
+                ++lineIndex;
             }
-            else
+        }
+        fz_drop_stext_page(ctx, text);
+    }
+    charIndex.build(rects);
+}
+
+/**
+ * @brief Load the links and annotation bounds with their spatial indexes
+ * on first use. Internal link destinations are resolved here, once, so
+ * following a link needs no document access.
+ *
+ * Cheap compared to loadText(): no page contents are run.
+ */
+void PagePrivate::loadLinks()
+{
+    if (linksLoaded)
+    {
+        return;
+    }
+    linksLoaded = true;
+    TRACE_SPAN("text", "Page links");
+
+    fz_context *ctx = documentp->threadContext();
+    QMutexLocker locker(&documentp->documentMutex);
+    if (!page)
+    {
+        return;
+    }
+
+    QVector<QRectF> rects;
+    fz_link *list = NULL;
+    fz_var(list);
+    fz_try(ctx)
+    {
+        list = fz_load_links(ctx, page);
+        for (fz_link *link = list; link; link = link->next)
+        {
+            Link result;
+            result.rect = toRectF(link->rect);
+            result.uri = QString::fromUtf8(link->uri);
+            result.page = -1;
+            if (link->uri && !fz_is_external_link(ctx, link->uri))
             {
-                // with white background
-                fz_clear_pixmap_with_value(d->context, pixmap, 0xff);
+                float x = 0;
+                float y = 0;
+                result.page = fz_resolve_link(ctx, document, link->uri, &x, &y);
+                result.target = QPointF(x, y);
             }
+            links.append(result);
+            rects.append(result.rect);
+        }
+    }
+    fz_always(ctx)
+    {
+        fz_drop_link(ctx, list);
+    }
+    fz_catch(ctx)
+    {
+        links.clear();
+        rects.clear();
+    }
+    linkIndex.build(rects);
+
+    rects.clear();
+    fz_try(ctx)
+    {
+        for (fz_annot *annot = fz_first_annot(ctx, page); annot; annot = fz_next_annot(ctx, annot))
+        {
+            fz_rect rect;
+            rects.append(toRectF(*fz_bound_annot(ctx, annot, &rect)));
+        }
+    }
+    fz_catch(ctx)
+    {
+        rects.clear();
+    }
+    annotationIndex.build(rects);
+}
+
+/**
+ * @brief Fill @p samples with the background, draw the page area @p bbox
+ * into it and apply gamma and the color effect.
+ *
+ * @param samples 8-bit gray or 32-bit premultiplied pixels, see imageFormat()
+ * @param alpha the output keeps transparency
+ * @param mono if not NULL, receives the halftoned 1-bit page (1 bits are
+ *             black); drop it with fz_drop_bitmap()
+ * @param annotations draw the annotations of loadAnnotations() instead of
+ *                    the page contents, on a transparent background;
+ *                    otherwise they are drawn on top of the contents if
+ *                    showAnnotations is on
+ */
+bool PagePrivate::draw(const fz_matrix &transform, const fz_irect &bbox, uchar *samples,
+                       int stride, bool gray, bool alpha, fz_bitmap **mono, bool annotations)
+{
+    fz_context *ctx = documentp->threadContext();
+    ContextGuard aaContext(NULL);
+    if (aaLevel >= 0)
+    {
+        // anti-aliasing is a per context setting, change it on a clone
+        aaContext.context = fz_clone_context(ctx);
+        if (aaContext.context)
+        {
+            fz_set_aa_level(aaContext.context, aaLevel);
+            ctx = aaContext.context;
         }
-        dev = fz_new_draw_device(d->context, NULL, pixmap);
-        fz_run_display_list(d->context, d->display_list, dev, &transform, &bounds, NULL);
+    }
+    qint64 traceBegin = TRACE_TIMESTAMP();
+    const bool withAnnotations = !annotations && showAnnotations && loadAnnotations();
 
-        samples = fz_pixmap_samples(d->context, pixmap);
-        width = fz_pixmap_width(d->context, pixmap);
-        height = fz_pixmap_height(d->context, pixmap);
-        size = width * height * 4;
+    const int width = bbox.x1 - bbox.x0;
+    const int height = bbox.y1 - bbox.y0;
+    const bool customBackground = (b >= 0 && g >= 0 && r >= 0 && a >= 0);
+    if (gray)
+    {
+        const int value = customBackground ? r : 0xff;
+        for (int y = 0; y < height; ++y)
+        {
+            memset(samples + size_t(y) * stride, value, size_t(width));
+        }
     }
-    fz_always(d->context)
+    else
     {
-        if (dev)
+        quint32 value = 0xffffffff; // white background
+        if (alpha && (transparent || annotations))
+            value = 0;
+        else if (customBackground)
+            value = qPremultiply(qRgba(r, g, b, alpha ? a : 255));
+        if (stride == width * 4)
         {
-            fz_close_device(d->context, dev);
-            fz_drop_device(d->context, dev);
+            PixelKernels::fill(reinterpret_cast<quint32 *>(samples), size_t(width) * height, value);
+        }
+        else
+        {
+            for (int y = 0; y < height; ++y)
+            {
+                PixelKernels::fill(reinterpret_cast<quint32 *>(samples + size_t(y) * stride), size_t(width), value);
+            }
         }
-        dev = NULL;
     }
-    fz_catch(d->context)
+    TRACE_SPAN_SINCE("render", "Page::renderImage clear", traceBegin);
+
+    // render to pixmap
+    fz_pixmap *pixmap = NULL;
+    fz_device *dev = NULL;
+    fz_bitmap *bitmap = NULL;
+    fz_var(pixmap);
+    fz_var(dev);
+    fz_var(bitmap);
+    fz_try(ctx)
     {
-        if (pixmap)
+        // the pixmap borrows the samples, pass the stride for padded rows
+        pixmap = fz_new_pixmap_with_data(ctx, gray ? fz_device_gray(ctx) : imageColorspace(ctx),
+                width, height, NULL, gray ? 0 : 1, stride, samples);
+        pixmap->x = bbox.x0;
+        pixmap->y = bbox.y0;
+
+        fz_rect area;
+        fz_rect_from_irect(&area, &bbox);
+        traceBegin = TRACE_TIMESTAMP();
+        dev = fz_new_draw_device(ctx, NULL, pixmap);
+        if (annotations)
+        {
+            foreach (fz_display_list *list, annot_lists)
+                fz_run_display_list(ctx, list, dev, &transform, &area, NULL);
+        }
+        else
+        {
+            run(ctx, dev, &transform, &area);
+            if (withAnnotations)
+            {
+                foreach (fz_display_list *list, annot_lists)
+                    fz_run_display_list(ctx, list, dev, &transform, &area, NULL);
+            }
+        }
+        fz_close_device(ctx, dev);
+        TRACE_SPAN_SINCE("render", "Page::renderImage draw", traceBegin);
+
+        const int rowBytes = width * (gray ? 1 : 4);
+        for (int y = 0; y < height; y += (stride == rowBytes) ? height : 1)
+        {
+            // row by row only if the rows are padded
+            uchar *row = samples + size_t(y) * stride;
+            const size_t count = size_t(width) * ((stride == rowBytes) ? height : 1);
+            if (gray)
+                applyGrayEffect(row, count);
+            else
+                applyColorEffect(reinterpret_cast<quint32 *>(row), count);
+        }
+
+        if (mono)
         {
-            fz_drop_pixmap(d->context, pixmap);
+            bitmap = fz_new_bitmap_from_pixmap(ctx, pixmap, NULL);
         }
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
+        dev = NULL;
+        fz_drop_pixmap(ctx, pixmap);
         pixmap = NULL;
     }
+    fz_catch(ctx)
+    {
+        fz_drop_bitmap(ctx, bitmap);
+        return false;
+    }
 
-    // render to QImage
-    QImage image;
-    if (NULL == pixmap)
+    if (mono)
     {
-        return image;
+        *mono = bitmap;
     }
-    copyed_samples = new unsigned char[size];
-    memcpy(copyed_samples, samples, size);
-    fz_drop_pixmap(d->context, pixmap);
+    return true;
+}
 
-    image = QImage(copyed_samples,
-            width, height, QImage::Format_RGBA8888, imageCleanupHandler, copyed_samples);
+/**
+ * @brief Gamma correction, then the color effect, on rendered pixels.
+ */
+void PagePrivate::applyColorEffect(quint32 *pixels, size_t count) const
+{
+    TRACE_SPAN("render", "Page color effect");
+    PixelKernels::gamma(pixels, count, gamma);
+    switch (effect)
+    {
+    case InvertColors:
+        PixelKernels::invert(pixels, count);
+        break;
+    case Grayscale:
+        PixelKernels::grayscale(pixels, count);
+        break;
+    case Sepia:
+        PixelKernels::sepia(pixels, count);
+        break;
+    case Tint:
+        PixelKernels::tint(pixels, count, tintR, tintG, tintB);
+        break;
+    default:
+        break;
+    }
+}
 
-    return image;
+/**
+ * @brief Gray counterpart of applyColorEffect(), for 8-bit pixels.
+ * Sepia and Tint never get here, Grayscale is a no-op.
+ */
+void PagePrivate::applyGrayEffect(uchar *pixels, size_t count) const
+{
+    TRACE_SPAN("render", "Page color effect");
+    PixelKernels::gammaGray(pixels, count, gamma);
+    if (effect == InvertColors)
+    {
+        PixelKernels::invertGray(pixels, count);
+    }
+}
+
+/**
+ * @brief Whether the page uses any non-gray color, computed once per
+ * page and document with a test device run over the display list.
+ */
+bool PagePrivate::hasColor()
+{
+    {
+        QMutexLocker locker(&documentp->documentMutex);
+        QHash<int, bool>::const_iterator it = documentp->colorPages.constFind(index);
+        if (it != documentp->colorPages.constEnd())
+        {
+            return it.value();
+        }
+    }
+
+    fz_context *ctx = documentp->threadContext();
+    fz_device *dev = NULL;
+    int color = 0;
+    fz_var(dev);
+    fz_var(color);
+    qint64 traceBegin = TRACE_TIMESTAMP();
+    fz_try(ctx)
+    {
+        // look at image and shading pixels too, scanned text pages often
+        // come as RGB images
+        dev = fz_new_test_device(ctx, &color, 0.02f,
+                FZ_TEST_OPT_IMAGES | FZ_TEST_OPT_SHADINGS, NULL);
+        run(ctx, dev, &fz_identity, &fz_infinite_rect);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx)
+    {
+        // the device throws to stop at the first color it finds; on any
+        // other error color is the safe answer as well
+        color = 1;
+    }
+    TRACE_SPAN_SINCE("render", "Page color test", traceBegin);
+
+    QMutexLocker locker(&documentp->documentMutex);
+    documentp->colorPages.insert(index, color != 0);
+    return color != 0;
+}
+
+/**
+ * @brief Run the page through @p dev: the display list if there is one,
+ * else the page contents, which needs the document lock.
+ *
+ * @note Throws MuPDF errors, call inside fz_try.
+ */
+void PagePrivate::run(fz_context *ctx, fz_device *dev, const fz_matrix *transform, const fz_rect *area)
+{
+    if (display_list)
+    {
+        fz_run_display_list(ctx, display_list, dev, transform, area, NULL);
+        return;
+    }
+
+    documentp->documentMutex.lock();
+    fz_try(ctx)
+    {
+        fz_run_page_contents(ctx, page, dev, transform, NULL);
+    }
+    fz_always(ctx)
+    {
+        documentp->documentMutex.unlock();
+    }
+    fz_catch(ctx)
+    {
+        fz_rethrow(ctx);
+    }
+}
+
+/**
+ * @brief Whether the page has any color, as opposed to only black, white
+ * and gray. The result is cached in the document.
+ */
+bool Page::hasColor() const
+{
+    return d->hasColor();
 }
 
 /**
@@ -188,8 +1099,7 @@ QImage Page::renderImage(float scaleX, float scaleY, float rotation) const
  */
 QSizeF Page::size() const
 {
-    fz_rect rect;
-    fz_bound_page(d->context, d->page, &rect);
+    const fz_rect &rect = d->bounds;
     return QSizeF(rect.x1 - rect.x0, rect.y1 - rect.y0);
 }
 
@@ -203,6 +1113,7 @@ QSizeF Page::size() const
 void Page::setTransparentRendering(bool enable)
 {
     d->transparent = enable;
+    d->settingsKey.clear();
 }
 
 /**
@@ -225,6 +1136,366 @@ void Page::setBackgroundColor(int r, int g, int b, int a)
     d->g = g;
     d->b = b;
     d->a = a;
+    d->settingsKey.clear();
+}
+
+/**
+ * @brief Choose the pixel format of rendered images.
+ * This function modify setting of current page only.
+ * For global setting, use Document::setRenderMode() instead.
+ */
+void Page::setRenderMode(RenderMode mode)
+{
+    d->renderMode = mode;
+    d->settingsKey.clear();
+}
+
+/**
+ * @brief Set color post-processing.
+ * This function modify setting of current page only.
+ * For global setting, use Document::setColorEffect() instead.
+ */
+void Page::setColorEffect(ColorEffect effect)
+{
+    d->effect = effect;
+    d->settingsKey.clear();
+}
+
+/**
+ * @brief Set the color white is mapped to by the Tint effect.
+ * This function modify setting of current page only.
+ */
+void Page::setTintColor(int r, int g, int b)
+{
+    d->tintR = r;
+    d->tintG = g;
+    d->tintB = b;
+    d->settingsKey.clear();
+}
+
+/**
+ * @brief Set gamma correction, 1.0f disables it.
+ * This function modify setting of current page only.
+ */
+void Page::setGamma(float gamma)
+{
+    d->gamma = gamma;
+    d->settingsKey.clear();
+}
+
+/**
+ * @brief Set the anti-aliasing level for text and graphics of this page.
+ *
+ * Fewer bits render faster: 2 bits are good enough for drafts while the
+ * user scrolls or zooms, 0 disables anti-aliasing.
+ *
+ * @param bits 0 to 8, -1 (default) uses the level of the context (8)
+ */
+void Page::setAntiAliasing(int bits)
+{
+    d->aaLevel = qBound(-1, bits, 8);
+}
+
+/**
+ * @brief Draw the annotations (filled form fields, notes, ...) on top of
+ * the page contents in renderImage(), renderRegion() and renderTo(), for
+ * output without a separate annotation layer such as printing.
+ *
+ * @param show false (default) renders the page contents only
+ */
+void Page::setShowAnnotations(bool show)
+{
+    d->showAnnotations = show;
+    d->settingsKey.clear();
+}
+
+/**
+ * @brief Split the text lines of @p text into words at white space.
+ */
+static void appendWords(const fz_stext_page *text, QVector<Word> *words)
+{
+    int blockIndex = 0;
+    int lineIndex = 0;
+    for (fz_stext_block *block = text->first_block; block; block = block->next)
+    {
+        if (block->type != FZ_STEXT_BLOCK_TEXT)
+            continue;
+        for (fz_stext_line *line = block->u.t.first_line; line; line = line->next)
+        {
+            Word word;
+            for (fz_stext_char *ch = line->first_char; ch; ch = ch->next)
+            {
+                const uint c = uint(ch->c);
+                if (QChar::isSpace(c))
+                {
+                    if (!word.text.isEmpty())
+                        words->append(word);
+                    word.text.clear();
+                    continue;
+                }
+                const QRectF bbox(ch->bbox.x0, ch->bbox.y0, ch->bbox.x1 - ch->bbox.x0, ch->bbox.y1 - ch->bbox.y0);
+                if (word.text.isEmpty())
+                {
+                    word.bbox = bbox;
+                    word.fontSize = ch->size;
+                    word.block = blockIndex;
+                    word.line = lineIndex;
+                }
+                else
+                {
+                    word.bbox |= bbox;
+                    word.fontSize = qMax(word.fontSize, ch->size);
+                }
+                if (QChar::requiresSurrogates(c))
+                {
+                    word.text += QChar(QChar::highSurrogate(c));
+                    word.text += QChar(QChar::lowSurrogate(c));
+                }
+                else
+                {
+                    word.text += QChar(c);
+                }
+            }
+            if (!word.text.isEmpty())
+                words->append(word);
+            ++lineIndex;
+        }
+        ++blockIndex;
+    }
+}
+
+/**
+ * @brief The words of the page in reading order, with their bounding
+ * boxes in points.
+ *
+ * Runs the display list into a structured text device, so pages of one
+ * document can be processed on several threads at once (each with a
+ * ThreadScope), see Document::streamPages().
+ *
+ * @param ok if not NULL, set to false when extraction failed, which an
+ *           empty result alone does not tell from a page without text
+ */
+QVector<Word> Page::words(bool *ok) const
+{
+    if (ok)
+        *ok = false;
+    QVector<Word> words;
+    fz_context *ctx = d->documentp->threadContext();
+    fz_stext_page *text = NULL;
+    fz_device *dev = NULL;
+    fz_var(text);
+    fz_var(dev);
+    fz_try(ctx)
+    {
+        text = fz_new_stext_page(ctx, &d->bounds);
+        dev = fz_new_stext_device(ctx, text, NULL);
+        d->run(ctx, dev, &fz_identity, &fz_infinite_rect);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx)
+    {
+        fz_drop_stext_page(ctx, text);
+        return words;
+    }
+
+    appendWords(text, &words);
+    fz_drop_stext_page(ctx, text);
+    if (ok)
+        *ok = true;
+    return words;
+}
+
+/**
+ * @brief The text of the page printed by MuPDF in @p format, UTF-8.
+ *
+ * Only the page itself is printed; Document::exportText() adds the
+ * document header and trailer of HTML, XHTML and XML output.
+ *
+ * @param ok if not NULL, set to false when extraction failed, which an
+ *           empty result alone does not tell from a page without text
+ */
+QByteArray Page::exportText(TextFormat format, bool *ok) const
+{
+    if (ok)
+        *ok = false;
+    QByteArray data;
+    fz_context *ctx = d->documentp->threadContext();
+    fz_stext_page *text = NULL;
+    fz_device *dev = NULL;
+    fz_buffer *buffer = NULL;
+    fz_output *out = NULL;
+    fz_var(text);
+    fz_var(dev);
+    fz_var(buffer);
+    fz_var(out);
+    fz_try(ctx)
+    {
+        text = fz_new_stext_page(ctx, &d->bounds);
+        dev = fz_new_stext_device(ctx, text, NULL);
+        d->run(ctx, dev, &fz_identity, &fz_infinite_rect);
+        fz_close_device(ctx, dev);
+
+        buffer = fz_new_buffer(ctx, 16 << 10);
+        out = fz_new_output_with_buffer(ctx, buffer);
+        switch (format)
+        {
+        case PlainText:
+            fz_print_stext_page_as_text(ctx, out, text);
+            fz_write_string(ctx, out, "\f\n");
+            break;
+        case HtmlText:
+            fz_print_stext_page_as_html(ctx, out, text);
+            break;
+        case XhtmlText:
+            fz_print_stext_page_as_xhtml(ctx, out, text);
+            break;
+        case XmlText:
+            fz_print_stext_page_as_xml(ctx, out, text);
+            break;
+        }
+        fz_close_output(ctx, out);
+
+        unsigned char *bytes = NULL;
+        size_t size = fz_buffer_storage(ctx, buffer, &bytes);
+        data = QByteArray(reinterpret_cast<const char *>(bytes), int(size));
+    }
+    fz_always(ctx)
+    {
+        fz_drop_output(ctx, out);
+        fz_drop_device(ctx, dev);
+        fz_drop_stext_page(ctx, text);
+        fz_drop_buffer(ctx, buffer);
+    }
+    fz_catch(ctx)
+    {
+        return QByteArray();
+    }
+    if (ok)
+        *ok = true;
+    return data;
+}
+
+/**
+ * @brief Ids of the characters selected by @p rect, in reading order:
+ * those whose box center lies inside it.
+ */
+static QVector<int> selectedChars(const RectIndex &index, const QRectF &rect)
+{
+    QVector<int> ids = index.intersecting(rect);
+    int kept = 0;
+    for (int i = 0; i < ids.size(); ++i)
+    {
+        if (rect.contains(index.rect(ids.at(i)).center()))
+            ids[kept++] = ids.at(i);
+    }
+    ids.resize(kept);
+    return ids;
+}
+
+/**
+ * @brief The text inside @p rect (in points), one line per text line.
+ *
+ * A character is inside when the center of its box is. The characters
+ * are looked up in a spatial index built on first use, see hasTextAt().
+ */
+QString Page::text(const QRectF &rect) const
+{
+    d->loadText();
+    QString text;
+    int line = -1;
+    foreach (int id, selectedChars(d->charIndex, rect))
+    {
+        if (line >= 0 && d->charLines.at(id) != line)
+        {
+            text += QLatin1Char('\n');
+        }
+        line = d->charLines.at(id);
+        const uint c = d->chars.at(id);
+        if (QChar::requiresSurrogates(c))
+        {
+            text += QChar(QChar::highSurrogate(c));
+            text += QChar(QChar::lowSurrogate(c));
+        }
+        else
+        {
+            text += QChar(c);
+        }
+    }
+    return text;
+}
+
+/**
+ * @brief Boxes to highlight the selection of text(@p rect): one per text
+ * line, in points.
+ */
+QVector<QRectF> Page::textRects(const QRectF &rect) const
+{
+    d->loadText();
+    QVector<QRectF> rects;
+    int line = -1;
+    foreach (int id, selectedChars(d->charIndex, rect))
+    {
+        if (d->charLines.at(id) != line)
+        {
+            line = d->charLines.at(id);
+            rects.append(d->charIndex.rect(id));
+        }
+        else
+        {
+            rects.last() |= d->charIndex.rect(id);
+        }
+    }
+    return rects;
+}
+
+/**
+ * @brief Whether a character is at @p point (in points), e.g. to show a
+ * text cursor.
+ *
+ * The first call builds the spatial index of the page characters; later
+ * ones only visit the few index nodes around the point.
+ */
+bool Page::hasTextAt(const QPointF &point) const
+{
+    d->loadText();
+    return !d->charIndex.containing(point).isEmpty();
+}
+
+/**
+ * @brief The links of the page with their destinations, loaded and
+ * resolved once per Page.
+ */
+QVector<Link> Page::links() const
+{
+    d->loadLinks();
+    return d->links;
+}
+
+/**
+ * @brief The link at @p point (in points), -1 if there is none.
+ *
+ * @return index into links()
+ */
+int Page::linkAt(const QPointF &point) const
+{
+    d->loadLinks();
+    const QVector<int> ids = d->linkIndex.containing(point);
+    return ids.isEmpty() ? -1 : ids.first();
+}
+
+/**
+ * @brief The annotation at @p point (in points), -1 if there is none.
+ * Annotations are numbered in page order, the topmost one wins.
+ */
+int Page::annotationAt(const QPointF &point) const
+{
+    d->loadLinks();
+    const QVector<int> ids = d->annotationIndex.containing(point);
+    return ids.isEmpty() ? -1 : ids.last();
 }
 
 PagePrivate::~PagePrivate()
@@ -232,6 +1503,7 @@ PagePrivate::~PagePrivate()
     if (page) 
     {
         deleteData();
+        QMutexLocker locker(&documentp->documentMutex);
         documentp->pages.removeAt(documentp->pages.indexOf(this));
     }
 }
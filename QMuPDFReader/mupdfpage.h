@@ -1,13 +1,17 @@
 #ifndef MUPDF_PAGE_H
 #define MUPDF_PAGE_H
 
+#include <QImage>
 #include <QList>
+#include <QPointF>
+#include <QRectF>
+#include <QString>
+#include <QVector>
+#include "mupdfdocument.h"
 
-class QImage;
-class QString;
-class QPointF;
 class QSizeF;
-class QRectF;
+class QRect;
+class QTransform;
 
 namespace MuPDF
 {
@@ -15,6 +19,29 @@ class Page;
 class PagePrivate;
 class Document;
 
+/**
+ * @brief A word of a page, see Page::words().
+ */
+struct Word
+{
+    QString text;
+    QRectF bbox;        // in points
+    float fontSize;     // largest glyph size in the word
+    int block;          // text block (paragraph) on the page
+    int line;           // line on the page
+};
+
+/**
+ * @brief A link of a page, see Page::links().
+ */
+struct Link
+{
+    QRectF rect;        // in points
+    QString uri;
+    int page;           // destination page, -1 for external links
+    QPointF target;     // destination on that page, in points
+};
+
 /**
  * @brief A page.
  *
@@ -27,10 +54,35 @@ public:
     ~Page();
     bool isValid() const;
     QImage renderImage(float scaleX = 1.0f, float scaleY = 1.0f, float rotation = 0.0f) const;
+    QImage renderRegion(const QRect &region, float scaleX = 1.0f, float scaleY = 1.0f, float rotation = 0.0f) const;
+    bool renderTo(uchar *buffer, int bytesPerLine, QImage::Format format,
+                  const QRect &region, const QTransform &matrix) const;
+    QImage renderAnnotations(float scaleX = 1.0f, float scaleY = 1.0f, float rotation = 0.0f) const;
+    bool hasAnnotations() const;
+    bool updateAnnotations(QImage *layer, const QRectF &rect,
+                           float scaleX = 1.0f, float scaleY = 1.0f, float rotation = 0.0f) const;
+    QVector<QRectF> textFields() const;
+    QString textFieldValue(int field) const;
+    bool setTextFieldValue(int field, const QString &text);
+    QVector<QRectF> takeDirtyRects();
     QSizeF size() const;
+    bool hasColor() const;
     void setTransparentRendering(bool enable);
     void setBackgroundColor(int r, int g, int b, int a = 255);
+    void setColorEffect(ColorEffect effect);
+    void setTintColor(int r, int g, int b);
+    void setGamma(float gamma);
+    void setRenderMode(RenderMode mode);
+    void setAntiAliasing(int bits);
+    void setShowAnnotations(bool show);
     QString text(const QRectF &rect) const;
+    QVector<QRectF> textRects(const QRectF &rect) const;
+    bool hasTextAt(const QPointF &point) const;
+    QVector<Link> links() const;
+    int linkAt(const QPointF &point) const;
+    int annotationAt(const QPointF &point) const;
+    QVector<Word> words(bool *ok = NULL) const;
+    QByteArray exportText(TextFormat format, bool *ok = NULL) const;
 
 private:
     Page(PagePrivate *pagep)
@@ -41,6 +93,7 @@ private:
     PagePrivate *d;
 
 friend class Document;
+friend class Spooler;
 };
 
 } // end namespace MuPDF
@@ -2,39 +2,84 @@
 #define MUPDF_PAGE_P_H
 
 #include "fitz.h"
+#include "mupdfdocument_p.h"
+#include "mupdfpage.h"
+#include "rectindex.h"
+
+#include <QMutexLocker>
+#include <QRectF>
+#include <QVector>
 
 namespace MuPDF
 {
 
-class DocumentPrivate;
-
 class PagePrivate
 {
 public:
-    PagePrivate(DocumentPrivate *dp, int index);
+    PagePrivate(DocumentPrivate *dp, int index, bool buildDisplayList = true);
     ~PagePrivate();
 
     void deleteData()
     {
+        fz_context *context = documentp->threadContext();
         if (display_list)
         {
             fz_drop_display_list(context, display_list);
             display_list = NULL;
         }
+        foreach (fz_display_list *list, annot_lists)
+        {
+            fz_drop_display_list(context, list);
+        }
+        annot_lists.clear();
         if (page)
         {
+            QMutexLocker locker(&documentp->documentMutex);
             fz_drop_page(context, page);
             page = NULL;
         }
     }
 
+    void applyColorEffect(quint32 *pixels, size_t count) const;
+    void applyGrayEffect(uchar *pixels, size_t count) const;
+    bool hasColor();
+    void run(fz_context *ctx, fz_device *dev, const fz_matrix *transform, const fz_rect *area);
+    bool draw(const fz_matrix &transform, const fz_irect &bbox, uchar *samples,
+              int stride, bool gray, bool alpha, fz_bitmap **mono, bool annotations = false);
+    bool loadAnnotations();
+    bool reloadAnnotations(fz_context *ctx, const QVector<int> &indexes);
+    void loadText();
+    void loadLinks();
+    pdf_widget *textField(fz_context *ctx, int field);
+
     DocumentPrivate *documentp;
-    fz_context *context;
     fz_document *document;
     fz_page *page;
-    fz_display_list *display_list;
+    fz_display_list *display_list;  // page contents without annotations
+    QVector<fz_display_list *> annot_lists; // one per annotation, see loadAnnotations()
+    bool annotationsLoaded;
+    QVector<QRectF> dirtyRects;     // see Page::takeDirtyRects()
+    bool textLoaded;                // see loadText()
+    QVector<uint> chars;            // characters, ids of charIndex
+    QVector<int> charLines;         // text line of each character
+    RectIndex charIndex;
+    bool linksLoaded;               // see loadLinks()
+    QVector<Link> links;
+    RectIndex linkIndex;            // ids are indexes into links
+    RectIndex annotationIndex;
+    fz_rect bounds; // page bounds at 72 dpi
     bool transparent;
     int b, g, r, a; // background color
+    ColorEffect effect;
+    int tintR, tintG, tintB;
+    float gamma;
+    RenderMode renderMode;
+    // DocumentPrivate::settingsKey() of the settings above, taken with
+    // them; empty once a Page setter changed one, see Document::cachePage()
+    QByteArray settingsKey;
+    int aaLevel; // -1: the context's anti-aliasing level
+    bool showAnnotations;   // see Page::setShowAnnotations()
+    int index;
 };
 
 }
@@ -0,0 +1,336 @@
+#include "mupdfspooler.h"
+#include "mupdfdocument.h"
+#include "mupdfdocument_p.h"
+#include "mupdfpage.h"
+#include "mupdfpage_p.h"
+#include "tracing.h"
+#include "fitz.h"
+
+#include <QIODevice>
+#include <QString>
+
+/**
+ * @brief fz_output write callback for QIODevice targets.
+ */
+static void writeToDevice(fz_context *ctx, void *state, const void *data, size_t n)
+{
+    QIODevice *device = static_cast<QIODevice *>(state);
+    if (device->write(static_cast<const char *>(data), n) != static_cast<qint64>(n))
+    {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "cannot write spool data");
+    }
+}
+
+namespace MuPDF
+{
+
+class SpoolerPrivate
+{
+public:
+    SpoolerPrivate(Document *doc, DocumentPrivate *dp, Spooler::Format f, Spooler::ColorMode m)
+        : document(doc)
+        , documentp(dp)
+        , format(f)
+        , mode(m)
+        , dpi(300)
+        , bandHeight(256)
+        , pageCount(0)
+        , out(NULL)
+        , writer(NULL)
+    {
+        memset(&pcl, 0, sizeof(pcl));
+        memset(&pclm, 0, sizeof(pclm));
+    }
+
+    bool open(const char *path, QIODevice *device);
+
+    Document *document;
+    DocumentPrivate *documentp;
+    Spooler::Format format;
+    Spooler::ColorMode mode;
+    int dpi;
+    int bandHeight;
+    int pageCount;
+    fz_output *out;
+    fz_band_writer *writer;
+    // the writers keep pointers to these for the whole job
+    fz_pcl_options pcl;
+    fz_pclm_options pclm;
+    QString error;
+};
+
+/**
+ * @brief Create the output and the band writer for the format.
+ */
+bool SpoolerPrivate::open(const char *path, QIODevice *device)
+{
+    fz_context *ctx = documentp->threadContext();
+
+    if (out)
+    {
+        error = QStringLiteral("spooler is already open");
+        return false;
+    }
+    if (!Spooler::isSupported(format, mode))
+    {
+        error = QStringLiteral("color mode not supported by this format");
+        return false;
+    }
+
+    fz_try(ctx)
+    {
+        if (path)
+            out = fz_new_output_with_path(ctx, path, 0);
+        else
+            out = fz_new_output(ctx, device, writeToDevice, NULL, NULL);
+
+        switch (format)
+        {
+        case Spooler::PWG:
+            fz_write_pwg_file_header(ctx, out);
+            if (mode == Spooler::Mono)
+                writer = fz_new_mono_pwg_band_writer(ctx, out, NULL);
+            else
+                writer = fz_new_pwg_band_writer(ctx, out, NULL);
+            break;
+        case Spooler::PCL:
+            fz_pcl_preset(ctx, &pcl, "generic");
+            if (mode == Spooler::Mono)
+                writer = fz_new_mono_pcl_band_writer(ctx, out, &pcl);
+            else
+                writer = fz_new_color_pcl_band_writer(ctx, out, &pcl);
+            break;
+        case Spooler::PCLm:
+            fz_parse_pclm_options(ctx, &pclm, "compression=flate");
+            writer = fz_new_pclm_band_writer(ctx, out, &pclm);
+            break;
+        }
+    }
+    fz_catch(ctx)
+    {
+        error = QString::fromUtf8(fz_caught_message(ctx));
+        fz_drop_output(ctx, out);
+        out = NULL;
+        return false;
+    }
+    pageCount = 0;
+    return true;
+}
+
+/**
+ * @brief Prepare spooling of @p document.
+ *
+ * @param document the document to print, must outlive the spooler
+ * @param format printer language
+ * @param mode Color for RGB, Gray for 8-bit gray, Mono for 1-bit halftoned
+ */
+Spooler::Spooler(Document *document, Format format, ColorMode mode)
+    : d(new SpoolerPrivate(document, document->d, format, mode))
+{
+}
+
+Spooler::~Spooler()
+{
+    close();
+    delete d;
+    d = NULL;
+}
+
+/**
+ * @brief Whether the band writers of @p format accept @p mode.
+ */
+bool Spooler::isSupported(Format format, ColorMode mode)
+{
+    switch (format)
+    {
+    case PWG:
+        return true;
+    case PCL:
+        return mode != Gray;
+    case PCLm:
+        return mode != Mono;
+    }
+    return false;
+}
+
+/**
+ * @brief Output resolution in dots per inch (default 300).
+ */
+void Spooler::setResolution(int dpi)
+{
+    d->dpi = qMax(1, dpi);
+}
+
+/**
+ * @brief Rows rasterized at a time (default 256). Memory use is one band.
+ */
+void Spooler::setBandHeight(int rows)
+{
+    d->bandHeight = qMax(1, rows);
+}
+
+/**
+ * @brief Spool to a file. Named pipes and devices work as well.
+ */
+bool Spooler::open(const QString &filePath)
+{
+    return d->open(filePath.toUtf8().constData(), NULL);
+}
+
+/**
+ * @brief Spool to an open device, e.g. a QProcess or a QLocalSocket.
+ * The device is not closed by the spooler.
+ */
+bool Spooler::open(QIODevice *device)
+{
+    return d->open(NULL, device);
+}
+
+/**
+ * @brief Rasterize one page and stream it to the output.
+ *
+ * @param index page index, begin with 0
+ *
+ * @return false if the page cannot be loaded or written; the job is
+ * probably unusable after a write error.
+ */
+bool Spooler::writePage(int index)
+{
+    if (!d->writer)
+    {
+        d->error = QStringLiteral("spooler is not open");
+        return false;
+    }
+
+    Page *page = d->document->page(index);
+    if (!page)
+    {
+        d->error = QStringLiteral("cannot load page %1").arg(index);
+        return false;
+    }
+
+    fz_context *ctx = d->documentp->threadContext();
+    PagePrivate *pagep = page->d;
+    // filled form fields and notes are printed with the page
+    pagep->loadAnnotations();
+    const bool mono = (d->mode == Mono);
+    fz_colorspace *colorspace = (d->mode == Color) ? fz_device_rgb(ctx) : fz_device_gray(ctx);
+    fz_pixmap *pixmap = NULL;
+    fz_bitmap *bitmap = NULL;
+    fz_device *dev = NULL;
+    bool ok = true;
+
+    fz_var(pixmap);
+    fz_var(bitmap);
+    fz_var(dev);
+
+    // build transform matrix
+    fz_matrix transform;
+    fz_scale(&transform, d->dpi / 72.0f, d->dpi / 72.0f);
+    fz_rect bounds = pagep->bounds;
+    fz_irect bbox;
+    fz_round_rect(&bbox, fz_transform_rect(&bounds, &transform));
+    const int width = bbox.x1 - bbox.x0;
+    const int height = bbox.y1 - bbox.y0;
+
+    fz_try(ctx)
+    {
+        // one band sized pixmap, moved down the page like mudraw does
+        fz_irect band = bbox;
+        band.y1 = band.y0 + qMin(d->bandHeight, height);
+        pixmap = fz_new_pixmap_with_bbox(ctx, colorspace, &band, NULL, 0);
+        fz_set_pixmap_resolution(ctx, pixmap, d->dpi, d->dpi);
+
+        fz_write_header(ctx, d->writer, width, height, mono ? 1 : pixmap->n, 0,
+                d->dpi, d->dpi, ++d->pageCount, mono ? NULL : colorspace, NULL);
+
+        for (int y = 0; y < height; y += d->bandHeight)
+        {
+            qint64 traceBegin = TRACE_TIMESTAMP();
+            int rows = qMin(d->bandHeight, height - y);
+            fz_rect area;
+            pixmap->y = bbox.y0 + y;
+            fz_pixmap_bbox(ctx, pixmap, &band);
+            fz_rect_from_irect(&area, &band);
+
+            fz_clear_pixmap_with_value(ctx, pixmap, 0xff);
+            dev = fz_new_draw_device(ctx, NULL, pixmap);
+            fz_run_display_list(ctx, pagep->display_list, dev, &transform, &area, NULL);
+            foreach (fz_display_list *list, pagep->annot_lists)
+                fz_run_display_list(ctx, list, dev, &transform, &area, NULL);
+            fz_close_device(ctx, dev);
+            fz_drop_device(ctx, dev);
+            dev = NULL;
+
+            if (mono)
+            {
+                bitmap = fz_new_bitmap_from_pixmap_band(ctx, pixmap, NULL, y);
+                fz_write_band(ctx, d->writer, bitmap->stride, rows, bitmap->samples);
+                fz_drop_bitmap(ctx, bitmap);
+                bitmap = NULL;
+            }
+            else
+            {
+                fz_write_band(ctx, d->writer, pixmap->stride, rows, pixmap->samples);
+            }
+            TRACE_SPAN_SINCE("render", "Spooler band", traceBegin);
+        }
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
+        fz_drop_bitmap(ctx, bitmap);
+        fz_drop_pixmap(ctx, pixmap);
+    }
+    fz_catch(ctx)
+    {
+        d->error = QString::fromUtf8(fz_caught_message(ctx));
+        ok = false;
+    }
+
+    delete page;
+    return ok;
+}
+
+/**
+ * @brief Finish the job: write trailers and flush the output.
+ */
+bool Spooler::close()
+{
+    if (!d->out)
+    {
+        return true;
+    }
+
+    fz_context *ctx = d->documentp->threadContext();
+    fz_band_writer *writer = d->writer;
+    bool ok = true;
+    d->writer = NULL;
+    fz_try(ctx)
+    {
+        // PCLm writes its cross reference table when dropped
+        fz_drop_band_writer(ctx, writer);
+        fz_close_output(ctx, d->out);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_output(ctx, d->out);
+        d->out = NULL;
+    }
+    fz_catch(ctx)
+    {
+        d->error = QString::fromUtf8(fz_caught_message(ctx));
+        ok = false;
+    }
+    return ok;
+}
+
+/**
+ * @brief Message of the last failure.
+ */
+QString Spooler::errorString() const
+{
+    return d->error;
+}
+
+} // end namespace MuPDF
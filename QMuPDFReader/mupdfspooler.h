@@ -0,0 +1,68 @@
+#ifndef MUPDF_SPOOLER_H
+#define MUPDF_SPOOLER_H
+
+class QIODevice;
+class QString;
+
+namespace MuPDF
+{
+class Document;
+class SpoolerPrivate;
+
+/**
+ * @brief Streams pages as printer raster data (PWG, PCL or PCLm).
+ *
+ * Pages are rasterized band by band straight into MuPDF's band writers,
+ * without going through QImage or QPrinter. Output goes to a file, a
+ * pipe or any QIODevice, e.g. a QProcess running "lp -o raw" for a CUPS
+ * raw queue or a file in a spool directory. Annotations, e.g. filled
+ * form fields, are printed on top of the page contents.
+ *
+ * Supported combinations (see isSupported()):
+ *  - PWG:  Color (8-bit RGB), Gray (8-bit), Mono (1-bit, halftoned)
+ *  - PCL:  Color (8-bit RGB), Mono (1-bit, halftoned)
+ *  - PCLm: Color (8-bit RGB), Gray (8-bit)
+ *
+ * @note Use a Spooler from one thread only. If that is not the thread
+ * that loaded the document, keep a ThreadScope alive meanwhile.
+ */
+class Spooler
+{
+public:
+    enum Format
+    {
+        PWG,
+        PCL,
+        PCLm
+    };
+
+    enum ColorMode
+    {
+        Color,
+        Gray,
+        Mono
+    };
+
+    Spooler(Document *document, Format format, ColorMode mode = Color);
+    ~Spooler();
+
+    static bool isSupported(Format format, ColorMode mode);
+    void setResolution(int dpi);
+    void setBandHeight(int rows);
+    bool open(const QString &filePath);
+    bool open(QIODevice *device);
+    bool writePage(int index);
+    bool close();
+    QString errorString() const;
+
+private:
+    // disable copy
+    Spooler(const Spooler &);
+    Spooler &operator=(const Spooler &);
+
+    SpoolerPrivate *d;
+};
+
+} // end namespace MuPDF
+
+#endif // end MUPDF_SPOOLER_H
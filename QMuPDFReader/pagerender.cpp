@@ -1,44 +1,323 @@
 #include "pagerender.h"
 #include "mupdfdocument.h"
 #include "mupdfpage.h"
-#include <QPainter>
-#include <QUrl>
+#include "tracing.h"
+#include <QMutexLocker>
 
 PageRender::PageRender(QObject *parent)
     : QThread(parent)
-    , m_page(0)
-    , m_zoom(1.)
+    , m_maxThumbnailRequests(64)
+    , m_busy(false)
+    , m_quit(false)
     , m_document(NULL)
+    , m_generation(0)
 {
+    m_current.page = -1;
+    m_current.zoom = 0;
+    m_current.draft = false;
+    m_current.reload = false;
+    m_current.time = -1;
+    m_current.generation = 0;
+    m_currentType = PageRequest;
+    start();
 }
 
+PageRender::~PageRender()
+{
+    m_mutex.lock();
+    m_quit = true;
+    m_requestAdded.wakeAll();
+    m_mutex.unlock();
+    wait();
+}
+
+/**
+ * @brief The current document generation, see setDocument().
+ */
+int PageRender::generation() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_generation;
+}
+
+/**
+ * @brief Switch documents. Drops queued requests and waits for a running
+ * one, so the previous document can be deleted afterwards. Results of the
+ * previous document may still be queued to receivers, the generation
+ * changes so they can tell.
+ */
 void PageRender::setDocument(MuPDF::Document* document)
 {
+    QMutexLocker locker(&m_mutex);
+    m_pageRequests.clear();
+    m_annotationRequests.clear();
+    m_thumbnailRequests.clear();
+    while (m_busy)
+    {
+        m_idle.wait(&m_mutex);
+    }
     m_document = document;
+    ++m_generation;
+}
+
+/**
+ * @brief Drop queued requests and start a new generation, e.g. after the
+ * render settings of the document changed. A running request finishes
+ * with the old settings, receivers drop its result by the generation.
+ */
+void PageRender::invalidate()
+{
+    QMutexLocker locker(&m_mutex);
+    m_pageRequests.clear();
+    m_annotationRequests.clear();
+    m_thumbnailRequests.clear();
+    ++m_generation;
+}
+
+/**
+ * @brief Queue a page for the main view.
+ *
+ * @param draft render fast with reduced anti-aliasing, e.g. while the
+ *              user scrolls; request it again without @p draft when the
+ *              view is idle
+ */
+void PageRender::requestPage(int page, qreal zoom, bool draft)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_busy && m_currentType == PageRequest && m_current.page == page && m_current.zoom == zoom
+            && m_current.draft == draft && m_current.generation == m_generation)
+    {
+        return;
+    }
+    for (int i = 0; i < m_pageRequests.size(); ++i)
+    {
+        if (m_pageRequests.at(i).page == page)
+        {
+            // a newer zoom and quality replace the queued ones
+            m_pageRequests[i].zoom = zoom;
+            m_pageRequests[i].draft = draft;
+            return;
+        }
+    }
+
+    Request request;
+    request.page = page;
+    request.zoom = zoom;
+    request.draft = draft;
+    request.reload = false;
+    request.time = TRACE_TIMESTAMP();
+    request.generation = m_generation;
+    m_pageRequests.append(request);
+    m_requestAdded.wakeOne();
+}
+
+/**
+ * @brief Queue the annotation layer of a page, see
+ * MuPDF::Page::renderAnnotations(). Served after all page requests.
+ *
+ * @param reload render again instead of reading the page cache, e.g.
+ *               after annotations were edited
+ */
+void PageRender::requestAnnotations(int page, qreal zoom, bool reload)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_busy && m_currentType == AnnotationRequest && m_current.page == page && m_current.zoom == zoom
+            && !reload && m_current.generation == m_generation)
+    {
+        return;
+    }
+    for (int i = 0; i < m_annotationRequests.size(); ++i)
+    {
+        if (m_annotationRequests.at(i).page == page)
+        {
+            m_annotationRequests[i].zoom = zoom;
+            m_annotationRequests[i].reload |= reload;
+            return;
+        }
+    }
+
+    Request request;
+    request.page = page;
+    request.zoom = zoom;
+    request.draft = false;
+    request.reload = reload;
+    request.time = TRACE_TIMESTAMP();
+    request.generation = m_generation;
+    m_annotationRequests.append(request);
+    m_requestAdded.wakeOne();
+}
+
+/**
+ * @brief Queue a thumbnail at the lowest priority. Only the most recent
+ * requests are kept, older ones (rows scrolled away) are dropped.
+ */
+void PageRender::requestThumbnail(int page, const QSize &size)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_busy && m_currentType == ThumbnailRequest && m_current.page == page && m_current.size == size
+            && m_current.generation == m_generation)
+    {
+        return;
+    }
+    for (int i = 0; i < m_thumbnailRequests.size(); ++i)
+    {
+        if (m_thumbnailRequests.at(i).page == page && m_thumbnailRequests.at(i).size == size)
+        {
+            m_thumbnailRequests.move(i, 0);
+            return;
+        }
+    }
+
+    Request request;
+    request.page = page;
+    request.zoom = 0;
+    request.draft = false;
+    request.reload = false;
+    request.size = size;
+    request.time = TRACE_TIMESTAMP();
+    request.generation = m_generation;
+    m_thumbnailRequests.prepend(request);
+    while (m_thumbnailRequests.size() > m_maxThumbnailRequests)
+    {
+        m_thumbnailRequests.removeLast();
+    }
+    m_requestAdded.wakeOne();
 }
 
-void PageRender::requestPage(int page, qreal zoom, Priority priority)
+/**
+ * @brief Wait for the next request: pages, then annotation layers, then
+ * thumbnails.
+ *
+ * @return false when the thread should quit.
+ */
+bool PageRender::takeRequest(Request *request, RequestType *type)
 {
-    m_page = page;
-    m_zoom = zoom;
-    start(priority);
+    QMutexLocker locker(&m_mutex);
+    m_busy = false;
+    m_idle.wakeAll();
+    while (!m_quit && (!m_document || (m_pageRequests.isEmpty() && m_annotationRequests.isEmpty()
+                                       && m_thumbnailRequests.isEmpty())))
+    {
+        m_requestAdded.wait(&m_mutex);
+    }
+    if (m_quit)
+    {
+        return false;
+    }
+
+    if (!m_pageRequests.isEmpty())
+    {
+        *type = PageRequest;
+        *request = m_pageRequests.takeFirst();
+    }
+    else if (!m_annotationRequests.isEmpty())
+    {
+        *type = AnnotationRequest;
+        *request = m_annotationRequests.takeFirst();
+    }
+    else
+    {
+        *type = ThumbnailRequest;
+        *request = m_thumbnailRequests.takeFirst();
+    }
+    m_current = *request;
+    m_currentType = *type;
+    m_busy = true;
+    return true;
 }
 
 void PageRender::run()
 {
-    renderPage(m_page, m_zoom);
+    Request request;
+    RequestType type;
+
+    while (takeRequest(&request, &type))
+    {
+        switch (type)
+        {
+        case PageRequest:
+            TRACE_SPAN_SINCE("queue", "PageRender::queueWait", request.time);
+            renderPage(request);
+            break;
+        case AnnotationRequest:
+            TRACE_SPAN_SINCE("queue", "PageRender::annotationWait", request.time);
+            renderAnnotations(request);
+            break;
+        case ThumbnailRequest:
+            TRACE_SPAN_SINCE("queue", "PageRender::thumbnailWait", request.time);
+            renderThumbnail(request);
+            break;
+        }
+    }
 }
 
-void PageRender::renderPage(int page, qreal zoom)
+void PageRender::renderPage(const Request &request)
 {
-    if (!m_document)
+    TRACE_SPAN("render", "PageRender::renderPage");
+    const int page = request.page;
+    const qreal zoom = request.zoom;
+    const bool draft = request.draft;
+    // cached pages are full quality, also for drafts
+    const QImage cached = m_document->cachedPage(page, zoom);
+    if (!cached.isNull())
     {
+        emit pageReady(page, zoom, cached, false, request.generation);
         return;
     }
 
+    MuPDF::ThreadScope scope(m_document);
     MuPDF::Page* objpage = m_document->page(page);
-    const QImage &img = objpage->renderImage(zoom, zoom);
-    emit pageReady(page, zoom, img);
+    if (!objpage)
+    {
+        return;
+    }
+    if (draft)
+    {
+        objpage->setAntiAliasing(2);
+    }
+    const QImage img = objpage->renderImage(zoom, zoom);
+    emit pageReady(page, zoom, img, draft, request.generation);
+    // compressed and written in the background, the next page goes first;
+    // keyed by the settings objpage was rendered with
+    if (!draft)
+    {
+        m_document->cachePage(objpage, zoom, img);
+    }
+    delete objpage;
 }
 
+void PageRender::renderAnnotations(const Request &request)
+{
+    TRACE_SPAN("render", "PageRender::renderAnnotations");
+    const int page = request.page;
+    const qreal zoom = request.zoom;
+    QImage layer;
+    if (!request.reload && m_document->cachedAnnotations(page, zoom, &layer))
+    {
+        emit annotationsReady(page, zoom, layer, request.generation);
+        return;
+    }
+
+    MuPDF::ThreadScope scope(m_document);
+    // the page contents are not needed, skip recording them
+    MuPDF::Page *objpage = m_document->page(page, false);
+    if (!objpage)
+    {
+        return;
+    }
+    layer = objpage->renderAnnotations(zoom, zoom);
+    emit annotationsReady(page, zoom, layer, request.generation);
+    m_document->cacheAnnotations(objpage, zoom, layer);
+    delete objpage;
+}
 
+void PageRender::renderThumbnail(const Request &request)
+{
+    TRACE_SPAN("render", "PageRender::renderThumbnail");
+    MuPDF::ThreadScope scope(m_document);
+    const QImage img = m_document->thumbnail(request.page, request.size);
+    if (!img.isNull())
+    {
+        emit thumbnailReady(request.page, request.size, img, request.generation);
+    }
+}
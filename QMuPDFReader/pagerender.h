@@ -2,34 +2,93 @@
 #define PAGERENDER_H
 
 #include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QSize>
 #include <QThread>
+#include <QWaitCondition>
 #include "mupdfdocument.h"
 #include "mupdfpage.h"
 
+/**
+ * @brief Render scheduler: one worker thread serving queued requests.
+ *
+ * Page requests for the main view are served first, in request order.
+ * Draft requests, made while the user scrolls or zooms, render with
+ * reduced anti-aliasing and are not written to the page cache.
+ * Annotation layers are separate requests, served after the pages, so
+ * annotations can be shown, hidden or updated without rendering pages.
+ * Thumbnail requests only run while no page request waits, newest first,
+ * so thumbnails never delay what the user is looking at. Repeated
+ * requests for the same page are merged.
+ *
+ * Every result carries the generation it was rendered for; receivers
+ * drop results whose generation is no longer generation(), they were
+ * queued before setDocument() or invalidate().
+ */
 class PageRender : public QThread
 {
     Q_OBJECT
 
 public:
     explicit PageRender(QObject *parent = NULL);
+    ~PageRender();
+
+    int generation() const;
 
 signals:
-    void pageReady(int page, qreal zoom, QImage image);
+    void pageReady(int page, qreal zoom, QImage image, bool draft, int generation);
+    void annotationsReady(int page, qreal zoom, QImage layer, int generation);
+    void thumbnailReady(int page, QSize size, QImage image, int generation);
 
 public slots:
     void setDocument(MuPDF::Document* document);
-    void requestPage(int page, qreal zoom, Priority priority = QThread::NormalPriority);
+    void invalidate();
+    void requestPage(int page, qreal zoom, bool draft = false);
+    void requestAnnotations(int page, qreal zoom, bool reload = false);
+    void requestThumbnail(int page, const QSize &size);
 
 protected:
     void run();
 
 private:
-    void renderPage(int page, qreal zoom);
+    enum RequestType
+    {
+        PageRequest,
+        AnnotationRequest,
+        ThumbnailRequest
+    };
+
+    struct Request
+    {
+        int page;
+        qreal zoom;         // page and annotation requests
+        bool draft;
+        bool reload;        // annotation requests, bypass the page cache
+        QSize size;         // thumbnail requests
+        qint64 time;
+        int generation;     // document the request was made for
+    };
+
+    bool takeRequest(Request *request, RequestType *type);
+    void renderPage(const Request &request);
+    void renderAnnotations(const Request &request);
+    void renderThumbnail(const Request &request);
 
 private:
-    int   m_page;
-    qreal m_zoom;
+    mutable QMutex m_mutex;
+    QWaitCondition m_requestAdded;
+    QWaitCondition m_idle;
+    QList<Request> m_pageRequests;
+    QList<Request> m_annotationRequests;
+    QList<Request> m_thumbnailRequests; // newest first
+    int m_maxThumbnailRequests;
+    Request m_current;
+    RequestType m_currentType;
+    bool m_busy;
+    bool m_quit;
     MuPDF::Document *m_document;
+    int m_generation;   // incremented by setDocument() and invalidate()
 };
 
 #endif // PAGERENDER_H
@@ -0,0 +1,597 @@
+#include "pixelkernels.h"
+
+#include <math.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIXELKERNELS_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define PIXELKERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang only emit AVX2 instructions in functions marked for it,
+// MSVC accepts the intrinsics anywhere
+#if defined(PIXELKERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+namespace
+{
+
+// color matrices use 8.8 fixed point coefficients, row by row R, G, B
+const int fixedOne = 256;
+
+typedef void (*FillFn)(quint32 *pixels, size_t count, quint32 value);
+typedef void (*InvertFn)(quint32 *pixels, size_t count);
+typedef void (*MatrixFn)(quint32 *pixels, size_t count, const int m[9]);
+typedef void (*InvertGrayFn)(uchar *pixels, size_t count);
+
+/*
+ * Scalar versions, also used for the tails of the SIMD versions.
+ */
+
+void fillScalar(quint32 *pixels, size_t count, quint32 value)
+{
+    for (size_t i = 0; i < count; ++i)
+        pixels[i] = value;
+}
+
+void invertScalar(quint32 *pixels, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        // premultiplied: every color byte is <= alpha, so no byte borrows
+        quint32 p = pixels[i];
+        quint32 a = p >> 24;
+        pixels[i] = (p & 0xff000000) | ((a * 0x010101) - (p & 0x00ffffff));
+    }
+}
+
+void invertGrayScalar(uchar *pixels, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        pixels[i] = uchar(~pixels[i]);
+}
+
+inline int clampChannel(int value, int alpha)
+{
+    return value < 0 ? 0 : (value > alpha ? alpha : value);
+}
+
+void matrixScalar(quint32 *pixels, size_t count, const int m[9])
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        quint32 p = pixels[i];
+        int a = p >> 24;
+        int r = (p >> 16) & 0xff;
+        int g = (p >> 8) & 0xff;
+        int b = p & 0xff;
+        int nr = clampChannel((m[0] * r + m[1] * g + m[2] * b + fixedOne / 2) >> 8, a);
+        int ng = clampChannel((m[3] * r + m[4] * g + m[5] * b + fixedOne / 2) >> 8, a);
+        int nb = clampChannel((m[6] * r + m[7] * g + m[8] * b + fixedOne / 2) >> 8, a);
+        pixels[i] = (quint32(a) << 24) | (quint32(nr) << 16) | (quint32(ng) << 8) | quint32(nb);
+    }
+}
+
+#ifdef PIXELKERNELS_X86
+
+/*
+ * SSE2, 4 pixels at a time.
+ */
+
+TARGET_SSE2 void fillSse2(quint32 *pixels, size_t count, quint32 value)
+{
+    const __m128i v = _mm_set1_epi32(int(value));
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + i), v);
+    fillScalar(pixels + i, count - i, value);
+}
+
+TARGET_SSE2 void invertSse2(quint32 *pixels, size_t count)
+{
+    const __m128i alphaMask = _mm_set1_epi32(int(0xff000000));
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i *ptr = reinterpret_cast<__m128i *>(pixels + i);
+        __m128i v = _mm_loadu_si128(ptr);
+        __m128i a = _mm_srli_epi32(v, 24);
+        __m128i aaa = _mm_or_si128(a, _mm_or_si128(_mm_slli_epi32(a, 8), _mm_slli_epi32(a, 16)));
+        __m128i color = _mm_andnot_si128(alphaMask, v);
+        _mm_storeu_si128(ptr, _mm_or_si128(_mm_and_si128(v, alphaMask), _mm_sub_epi32(aaa, color)));
+    }
+    invertScalar(pixels + i, count - i);
+}
+
+TARGET_SSE2 void invertGraySse2(uchar *pixels, size_t count)
+{
+    const __m128i ones = _mm_set1_epi32(-1);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i *ptr = reinterpret_cast<__m128i *>(pixels + i);
+        _mm_storeu_si128(ptr, _mm_xor_si128(_mm_loadu_si128(ptr), ones));
+    }
+    invertGrayScalar(pixels + i, count - i);
+}
+
+// SSE2 has no 32-bit multiply; with both high halves zero, madd_epi16
+// yields the plain product of the low halves
+TARGET_SSE2 inline __m128i mulSse2(__m128i value, __m128i coefficient)
+{
+    return _mm_madd_epi16(value, coefficient);
+}
+
+TARGET_SSE2 inline __m128i matrixRowSse2(__m128i r, __m128i g, __m128i b, __m128i a,
+                                         __m128i c0, __m128i c1, __m128i c2)
+{
+    __m128i sum = _mm_add_epi32(_mm_add_epi32(mulSse2(r, c0), mulSse2(g, c1)),
+                                _mm_add_epi32(mulSse2(b, c2), _mm_set1_epi32(fixedOne / 2)));
+    sum = _mm_srai_epi32(sum, 8);
+    // clamp to [0, alpha]
+    sum = _mm_andnot_si128(_mm_srai_epi32(sum, 31), sum);
+    __m128i over = _mm_cmpgt_epi32(sum, a);
+    return _mm_or_si128(_mm_and_si128(over, a), _mm_andnot_si128(over, sum));
+}
+
+TARGET_SSE2 inline __m128i coefficientSse2(int c)
+{
+    return _mm_set1_epi32(c & 0xffff);
+}
+
+TARGET_SSE2 void matrixSse2(quint32 *pixels, size_t count, const int m[9])
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i c[9] = {
+        coefficientSse2(m[0]), coefficientSse2(m[1]), coefficientSse2(m[2]),
+        coefficientSse2(m[3]), coefficientSse2(m[4]), coefficientSse2(m[5]),
+        coefficientSse2(m[6]), coefficientSse2(m[7]), coefficientSse2(m[8])
+    };
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i *ptr = reinterpret_cast<__m128i *>(pixels + i);
+        __m128i v = _mm_loadu_si128(ptr);
+        __m128i a = _mm_srli_epi32(v, 24);
+        __m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), mask);
+        __m128i g = _mm_and_si128(_mm_srli_epi32(v, 8), mask);
+        __m128i b = _mm_and_si128(v, mask);
+        __m128i nr = matrixRowSse2(r, g, b, a, c[0], c[1], c[2]);
+        __m128i ng = matrixRowSse2(r, g, b, a, c[3], c[4], c[5]);
+        __m128i nb = matrixRowSse2(r, g, b, a, c[6], c[7], c[8]);
+        __m128i out = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(a, 24), _mm_slli_epi32(nr, 16)),
+                                   _mm_or_si128(_mm_slli_epi32(ng, 8), nb));
+        _mm_storeu_si128(ptr, out);
+    }
+    matrixScalar(pixels + i, count - i, m);
+}
+
+/*
+ * AVX2, 8 pixels at a time.
+ */
+
+TARGET_AVX2 void fillAvx2(quint32 *pixels, size_t count, quint32 value)
+{
+    const __m256i v = _mm256_set1_epi32(int(value));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(pixels + i), v);
+    fillScalar(pixels + i, count - i, value);
+}
+
+TARGET_AVX2 void invertAvx2(quint32 *pixels, size_t count)
+{
+    const __m256i alphaMask = _mm256_set1_epi32(int(0xff000000));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i *ptr = reinterpret_cast<__m256i *>(pixels + i);
+        __m256i v = _mm256_loadu_si256(ptr);
+        __m256i a = _mm256_srli_epi32(v, 24);
+        __m256i aaa = _mm256_or_si256(a, _mm256_or_si256(_mm256_slli_epi32(a, 8), _mm256_slli_epi32(a, 16)));
+        __m256i color = _mm256_andnot_si256(alphaMask, v);
+        _mm256_storeu_si256(ptr, _mm256_or_si256(_mm256_and_si256(v, alphaMask), _mm256_sub_epi32(aaa, color)));
+    }
+    invertScalar(pixels + i, count - i);
+}
+
+TARGET_AVX2 void invertGrayAvx2(uchar *pixels, size_t count)
+{
+    const __m256i ones = _mm256_set1_epi32(-1);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i *ptr = reinterpret_cast<__m256i *>(pixels + i);
+        _mm256_storeu_si256(ptr, _mm256_xor_si256(_mm256_loadu_si256(ptr), ones));
+    }
+    invertGrayScalar(pixels + i, count - i);
+}
+
+TARGET_AVX2 inline __m256i matrixRowAvx2(__m256i r, __m256i g, __m256i b, __m256i a,
+                                         __m256i c0, __m256i c1, __m256i c2)
+{
+    __m256i sum = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(r, c0), _mm256_mullo_epi32(g, c1)),
+                                   _mm256_add_epi32(_mm256_mullo_epi32(b, c2), _mm256_set1_epi32(fixedOne / 2)));
+    sum = _mm256_srai_epi32(sum, 8);
+    return _mm256_min_epi32(_mm256_max_epi32(sum, _mm256_setzero_si256()), a);
+}
+
+TARGET_AVX2 void matrixAvx2(quint32 *pixels, size_t count, const int m[9])
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256i c[9] = {
+        _mm256_set1_epi32(m[0]), _mm256_set1_epi32(m[1]), _mm256_set1_epi32(m[2]),
+        _mm256_set1_epi32(m[3]), _mm256_set1_epi32(m[4]), _mm256_set1_epi32(m[5]),
+        _mm256_set1_epi32(m[6]), _mm256_set1_epi32(m[7]), _mm256_set1_epi32(m[8])
+    };
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i *ptr = reinterpret_cast<__m256i *>(pixels + i);
+        __m256i v = _mm256_loadu_si256(ptr);
+        __m256i a = _mm256_srli_epi32(v, 24);
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(v, 16), mask);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 8), mask);
+        __m256i b = _mm256_and_si256(v, mask);
+        __m256i nr = matrixRowAvx2(r, g, b, a, c[0], c[1], c[2]);
+        __m256i ng = matrixRowAvx2(r, g, b, a, c[3], c[4], c[5]);
+        __m256i nb = matrixRowAvx2(r, g, b, a, c[6], c[7], c[8]);
+        __m256i out = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(a, 24), _mm256_slli_epi32(nr, 16)),
+                                      _mm256_or_si256(_mm256_slli_epi32(ng, 8), nb));
+        _mm256_storeu_si256(ptr, out);
+    }
+    matrixScalar(pixels + i, count - i, m);
+}
+
+bool hasSse2()
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    return true;
+#elif defined(_MSC_VER)
+    int regs[4];
+    __cpuidex(regs, 1, 0);
+    return (regs[3] & (1 << 26)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+bool hasAvx2()
+{
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuidex(regs, 0, 0);
+    if (regs[0] < 7)
+        return false;
+    __cpuidex(regs, 1, 0);
+    // the OS must save the YMM registers on context switches
+    const int osxsave = 1 << 27, avx = 1 << 28;
+    if ((regs[2] & (osxsave | avx)) != (osxsave | avx))
+        return false;
+    if ((_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // PIXELKERNELS_X86
+
+#ifdef PIXELKERNELS_NEON
+
+/*
+ * NEON, 4 pixels at a time.
+ */
+
+void fillNeon(quint32 *pixels, size_t count, quint32 value)
+{
+    const uint32x4_t v = vdupq_n_u32(value);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        vst1q_u32(pixels + i, v);
+    fillScalar(pixels + i, count - i, value);
+}
+
+void invertNeon(quint32 *pixels, size_t count)
+{
+    const uint32x4_t alphaMask = vdupq_n_u32(0xff000000);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        uint32x4_t v = vld1q_u32(pixels + i);
+        uint32x4_t a = vshrq_n_u32(v, 24);
+        uint32x4_t aaa = vmulq_n_u32(a, 0x010101);
+        uint32x4_t color = vbicq_u32(v, alphaMask);
+        vst1q_u32(pixels + i, vorrq_u32(vandq_u32(v, alphaMask), vsubq_u32(aaa, color)));
+    }
+    invertScalar(pixels + i, count - i);
+}
+
+void invertGrayNeon(uchar *pixels, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+        vst1q_u8(pixels + i, vmvnq_u8(vld1q_u8(pixels + i)));
+    invertGrayScalar(pixels + i, count - i);
+}
+
+inline uint32x4_t matrixRowNeon(int32x4_t r, int32x4_t g, int32x4_t b, int32x4_t a,
+                                int c0, int c1, int c2)
+{
+    int32x4_t sum = vdupq_n_s32(fixedOne / 2);
+    sum = vmlaq_n_s32(sum, r, c0);
+    sum = vmlaq_n_s32(sum, g, c1);
+    sum = vmlaq_n_s32(sum, b, c2);
+    sum = vshrq_n_s32(sum, 8);
+    return vreinterpretq_u32_s32(vminq_s32(vmaxq_s32(sum, vdupq_n_s32(0)), a));
+}
+
+void matrixNeon(quint32 *pixels, size_t count, const int m[9])
+{
+    const uint32x4_t mask = vdupq_n_u32(0xff);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        uint32x4_t v = vld1q_u32(pixels + i);
+        uint32x4_t a = vshrq_n_u32(v, 24);
+        int32x4_t sa = vreinterpretq_s32_u32(a);
+        int32x4_t r = vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(v, 16), mask));
+        int32x4_t g = vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(v, 8), mask));
+        int32x4_t b = vreinterpretq_s32_u32(vandq_u32(v, mask));
+        uint32x4_t nr = matrixRowNeon(r, g, b, sa, m[0], m[1], m[2]);
+        uint32x4_t ng = matrixRowNeon(r, g, b, sa, m[3], m[4], m[5]);
+        uint32x4_t nb = matrixRowNeon(r, g, b, sa, m[6], m[7], m[8]);
+        uint32x4_t out = vorrq_u32(vorrq_u32(vshlq_n_u32(a, 24), vshlq_n_u32(nr, 16)),
+                                   vorrq_u32(vshlq_n_u32(ng, 8), nb));
+        vst1q_u32(pixels + i, out);
+    }
+    matrixScalar(pixels + i, count - i, m);
+}
+
+#endif // PIXELKERNELS_NEON
+
+struct Kernels
+{
+    Kernels()
+        : instructionSet(PixelKernels::Scalar)
+        , fill(fillScalar)
+        , invert(invertScalar)
+        , matrix(matrixScalar)
+        , invertGray(invertGrayScalar)
+    {
+#ifdef PIXELKERNELS_X86
+        if (hasAvx2())
+        {
+            instructionSet = PixelKernels::AVX2;
+            fill = fillAvx2;
+            invert = invertAvx2;
+            matrix = matrixAvx2;
+            invertGray = invertGrayAvx2;
+        }
+        else if (hasSse2())
+        {
+            instructionSet = PixelKernels::SSE2;
+            fill = fillSse2;
+            invert = invertSse2;
+            matrix = matrixSse2;
+            invertGray = invertGraySse2;
+        }
+#elif defined(PIXELKERNELS_NEON)
+        instructionSet = PixelKernels::NEON;
+        fill = fillNeon;
+        invert = invertNeon;
+        matrix = matrixNeon;
+        invertGray = invertGrayNeon;
+#endif
+    }
+
+    PixelKernels::InstructionSet instructionSet;
+    FillFn fill;
+    InvertFn invert;
+    MatrixFn matrix;
+    InvertGrayFn invertGray;
+};
+
+const Kernels &kernels()
+{
+    // initialized once, thread-safe since C++11
+    static const Kernels instance;
+    return instance;
+}
+
+void gammaTable(uchar table[256], float gamma)
+{
+    for (int i = 0; i < 256; ++i)
+        table[i] = uchar(qRound(255.0 * pow(i / 255.0, double(gamma))));
+}
+
+void applyMatrix(quint32 *pixels, size_t count, const float matrix[9])
+{
+    int m[9];
+    for (int i = 0; i < 9; ++i)
+    {
+        // keep the coefficients within 16 bits for the SSE2 multiply
+        m[i] = qBound(-32767, qRound(matrix[i] * fixedOne), 32767);
+    }
+    kernels().matrix(pixels, count, m);
+}
+
+} // end anonymous namespace
+
+namespace PixelKernels
+{
+
+/**
+ * @brief Instruction set the kernels dispatch to on this CPU.
+ */
+InstructionSet instructionSet()
+{
+    return kernels().instructionSet;
+}
+
+const char *instructionSetName()
+{
+    switch (instructionSet())
+    {
+    case SSE2:
+        return "SSE2";
+    case AVX2:
+        return "AVX2";
+    case NEON:
+        return "NEON";
+    default:
+        return "scalar";
+    }
+}
+
+/**
+ * @brief Set every pixel to @p value, which must be premultiplied
+ * (see qPremultiply()).
+ */
+void fill(quint32 *pixels, size_t count, quint32 value)
+{
+    kernels().fill(pixels, count, value);
+}
+
+/**
+ * @brief Invert the colors, keeping alpha. White paper turns black, which
+ * is what a night reading mode wants.
+ */
+void invert(quint32 *pixels, size_t count)
+{
+    kernels().invert(pixels, count);
+}
+
+/**
+ * @brief Apply out = in ^ @p gamma to every color channel.
+ *
+ * Values above 1 darken mid tones (thin text gets heavier), values below
+ * 1 lighten them. This is a table lookup per channel, which SIMD gathers
+ * do not speed up, so there is only a scalar version.
+ */
+void gamma(quint32 *pixels, size_t count, float gamma)
+{
+    if (gamma <= 0.0f || qFuzzyCompare(gamma, 1.0f))
+        return;
+
+    uchar table[256];
+    gammaTable(table, gamma);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        quint32 p = pixels[i];
+        quint32 a = p >> 24;
+        quint32 r = (p >> 16) & 0xff;
+        quint32 g = (p >> 8) & 0xff;
+        quint32 b = p & 0xff;
+        if (a == 255)
+        {
+            r = table[r];
+            g = table[g];
+            b = table[b];
+        }
+        else if (a != 0)
+        {
+            // the curve applies to straight colors
+            r = table[r * 255 / a] * a / 255;
+            g = table[g * 255 / a] * a / 255;
+            b = table[b * 255 / a] * a / 255;
+        }
+        pixels[i] = (a << 24) | (r << 16) | (g << 8) | b;
+    }
+}
+
+/**
+ * @brief Multiply every color with a 3x3 matrix.
+ *
+ * @param matrix rows for red, green and blue output, each row weighting
+ *               the red, green and blue input. Results are clamped.
+ */
+void colorMatrix(quint32 *pixels, size_t count, const float matrix[9])
+{
+    applyMatrix(pixels, count, matrix);
+}
+
+/**
+ * @brief Replace colors by their luma (ITU-R BT.601 weights).
+ */
+void grayscale(quint32 *pixels, size_t count)
+{
+    static const float matrix[9] = {
+        0.299f, 0.587f, 0.114f,
+        0.299f, 0.587f, 0.114f,
+        0.299f, 0.587f, 0.114f
+    };
+    applyMatrix(pixels, count, matrix);
+}
+
+/**
+ * @brief Classic sepia tone.
+ */
+void sepia(quint32 *pixels, size_t count)
+{
+    static const float matrix[9] = {
+        0.393f, 0.769f, 0.189f,
+        0.349f, 0.686f, 0.168f,
+        0.272f, 0.534f, 0.131f
+    };
+    applyMatrix(pixels, count, matrix);
+}
+
+/**
+ * @brief Map luma onto a black to (@p r, @p g, @p b) ramp, e.g. a warm
+ * paper color. White becomes the tint color, black stays black.
+ */
+void tint(quint32 *pixels, size_t count, int r, int g, int b)
+{
+    const float tr = qBound(0, r, 255) / 255.0f;
+    const float tg = qBound(0, g, 255) / 255.0f;
+    const float tb = qBound(0, b, 255) / 255.0f;
+    const float matrix[9] = {
+        0.299f * tr, 0.587f * tr, 0.114f * tr,
+        0.299f * tg, 0.587f * tg, 0.114f * tg,
+        0.299f * tb, 0.587f * tb, 0.114f * tb
+    };
+    applyMatrix(pixels, count, matrix);
+}
+
+/**
+ * @brief Invert 8-bit gray pixels.
+ */
+void invertGray(uchar *pixels, size_t count)
+{
+    kernels().invertGray(pixels, count);
+}
+
+/**
+ * @brief gamma() for 8-bit gray pixels.
+ */
+void gammaGray(uchar *pixels, size_t count, float gamma)
+{
+    if (gamma <= 0.0f || qFuzzyCompare(gamma, 1.0f))
+        return;
+
+    uchar table[256];
+    gammaTable(table, gamma);
+    for (size_t i = 0; i < count; ++i)
+        pixels[i] = table[pixels[i]];
+}
+
+} // end namespace PixelKernels
@@ -0,0 +1,46 @@
+#ifndef PIXELKERNELS_H
+#define PIXELKERNELS_H
+
+#include <QtGlobal>
+#include <stddef.h>
+
+/**
+ * @brief Whole-buffer operations on 32-bit premultiplied pixels.
+ *
+ * Pixels are 0xAARRGGBB words as in QImage::Format_ARGB32_Premultiplied
+ * and Format_RGB32, the formats MuPDF::Page renders to, or bytes for
+ * the *Gray variants (QImage::Format_Grayscale8). Every kernel has
+ * a scalar version and SSE2, AVX2 or NEON versions; the fastest one the
+ * CPU supports is picked at the first call.
+ *
+ * The kernels are meant to run on the render threads right after
+ * rasterizing, so painting stays a plain blit.
+ */
+namespace PixelKernels
+{
+
+enum InstructionSet
+{
+    Scalar,
+    SSE2,
+    AVX2,
+    NEON
+};
+
+InstructionSet instructionSet();
+const char *instructionSetName();
+
+void fill(quint32 *pixels, size_t count, quint32 value);
+void invert(quint32 *pixels, size_t count);
+void gamma(quint32 *pixels, size_t count, float gamma);
+void colorMatrix(quint32 *pixels, size_t count, const float matrix[9]);
+void grayscale(quint32 *pixels, size_t count);
+void sepia(quint32 *pixels, size_t count);
+void tint(quint32 *pixels, size_t count, int r, int g, int b);
+
+void invertGray(uchar *pixels, size_t count);
+void gammaGray(uchar *pixels, size_t count, float gamma);
+
+} // end namespace PixelKernels
+
+#endif // PIXELKERNELS_H
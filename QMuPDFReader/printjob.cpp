@@ -0,0 +1,440 @@
+#include "printjob.h"
+#include "tracing.h"
+#include <QCoreApplication>
+#include <QPainter>
+#include <QPrinter>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QTransform>
+
+/**
+ * @brief Renders bands until the job runs out of pages or is cancelled.
+ */
+class PrintJob::Worker : public QRunnable
+{
+public:
+    explicit Worker(PrintJob *job)
+        : m_job(job)
+    {
+    }
+
+    void run()
+    {
+        if (m_job->m_spoolPath.isEmpty())
+            m_job->work();
+        else
+            m_job->spool();
+    }
+
+private:
+    PrintJob *m_job;
+};
+
+PrintJob::PrintJob(MuPDF::Document *document, QPrinter *printer, QObject *parent)
+    : QObject(parent)
+    , m_document(document)
+    , m_printer(printer)
+    , m_fromPage(0)
+    , m_toPage(document ? document->numPages() - 1 : -1)
+    , m_threadCount(qBound(1, QThread::idealThreadCount() - 1, 4))
+    , m_bandBytes(4 << 20)
+    , m_spoolFormat(MuPDF::Spooler::PWG)
+    , m_spoolMode(MuPDF::Spooler::Color)
+    , m_spoolResolution(300)
+    , m_spooledPages(0)
+    , m_nextPage(0)
+    , m_loadingPage(-1)
+    , m_nextBand(0)
+    , m_nextSequence(0)
+    , m_totalSequences(-1)
+    , m_consumed(0)
+    , m_cancelled(false)
+{
+}
+
+PrintJob::~PrintJob()
+{
+    foreach (const PrintPage &page, m_pages)
+    {
+        delete page.page;
+    }
+}
+
+/**
+ * @brief Pages to print, both inclusive and beginning with 0.
+ */
+void PrintJob::setPageRange(int fromPage, int toPage)
+{
+    m_fromPage = fromPage;
+    m_toPage = toPage;
+}
+
+/**
+ * @brief Number of rasterizing threads (default: cores - 1, at most 4).
+ */
+void PrintJob::setThreadCount(int count)
+{
+    m_threadCount = qMax(1, count);
+}
+
+/**
+ * @brief Write printer raster data to @p filePath instead of painting on
+ * the QPrinter. Only the printer's resolution is used.
+ *
+ * @param filePath file, named pipe or spool directory entry
+ * @param format PWG, PCL or PCLm
+ * @param mode color, 8-bit gray or 1-bit monochrome
+ */
+void PrintJob::setSpoolOutput(const QString &filePath, MuPDF::Spooler::Format format,
+                              MuPDF::Spooler::ColorMode mode)
+{
+    m_spoolPath = filePath;
+    m_spoolFormat = format;
+    m_spoolMode = mode;
+}
+
+/**
+ * @brief Why the last exec() failed, if it was not cancelled.
+ */
+QString PrintJob::errorString() const
+{
+    return m_error;
+}
+
+/**
+ * @brief Maximum number of bands rendered ahead of the printer.
+ */
+int PrintJob::bandWindow() const
+{
+    return 2 * m_threadCount + 2;
+}
+
+/**
+ * @brief Stop as soon as possible. exec() returns false.
+ */
+void PrintJob::cancel()
+{
+    QMutexLocker locker(&m_mutex);
+    m_cancelled = true;
+    m_bandReady.wakeAll();
+    m_bandTaken.wakeAll();
+    m_pageLoaded.wakeAll();
+}
+
+/**
+ * @brief Print the page range. Blocks until done, but keeps processing
+ * events so that progress can be shown and cancel() can be called.
+ *
+ * @return false if cancelled or the printer could not be opened.
+ */
+bool PrintJob::exec()
+{
+    if (!m_document || m_fromPage > m_toPage)
+    {
+        return false;
+    }
+    if (!m_spoolPath.isEmpty())
+    {
+        return execSpool();
+    }
+
+    QPainter painter;
+    if (!painter.begin(m_printer))
+    {
+        return false;
+    }
+    // painting on a QPrinter works in device pixels
+    m_area = painter.viewport();
+    m_nextPage = m_fromPage;
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(m_threadCount);
+    for (int i = 0; i < m_threadCount; ++i)
+    {
+        pool.start(new Worker(this));
+    }
+
+    const int totalPages = m_toPage - m_fromPage + 1;
+    int printedPages = 0;
+    int currentPage = -1;
+    bool cancelled = false;
+    emit progress(0, totalPages);
+
+    for (int sequence = 0; ; ++sequence)
+    {
+        PrintBand band;
+        bool haveBand = false;
+        bool finished = false;
+        qint64 traceBegin = TRACE_TIMESTAMP();
+        while (!haveBand && !finished)
+        {
+            m_mutex.lock();
+            if (m_cancelled)
+            {
+                cancelled = finished = true;
+            }
+            else if (m_bands.contains(sequence))
+            {
+                band = m_bands.take(sequence);
+                m_consumed = sequence + 1;
+                m_bandTaken.wakeAll();
+                haveBand = true;
+            }
+            else if (sequence == m_totalSequences)
+            {
+                finished = true;
+            }
+            else
+            {
+                m_bandReady.wait(&m_mutex, 50);
+            }
+            m_mutex.unlock();
+            QCoreApplication::processEvents();
+        }
+        TRACE_SPAN_SINCE("queue", "PrintJob band wait", traceBegin);
+        if (finished)
+        {
+            break;
+        }
+
+        if (band.page != currentPage)
+        {
+            if (currentPage >= 0)
+            {
+                m_printer->newPage();
+            }
+            currentPage = band.page;
+        }
+        if (!band.image.isNull())
+        {
+            TRACE_SPAN("paint", "PrintJob drawImage");
+            painter.drawImage(band.position, band.image);
+            m_bandPool.release(band.image);
+        }
+        if (band.lastOfPage)
+        {
+            emit progress(++printedPages, totalPages);
+        }
+    }
+
+    if (cancelled)
+    {
+        m_printer->abort();
+    }
+    painter.end();
+    pool.waitForDone();
+    return !cancelled;
+}
+
+/**
+ * @brief Load a page and fit it into the printable area. Its annotations,
+ * e.g. filled form fields, are printed with it.
+ */
+PrintJob::PrintPage PrintJob::loadPage(int pageIndex)
+{
+    PrintPage printPage;
+    printPage.page = m_document->page(pageIndex);
+    printPage.scale = 0.0f;
+    printPage.bandHeight = 1;
+    printPage.bandCount = 1;
+    printPage.pendingBands = 1;
+
+    if (printPage.page)
+    {
+        printPage.page->setShowAnnotations(true);
+        QSizeF size = printPage.page->size();
+        if (size.width() > 0 && size.height() > 0)
+        {
+            printPage.scale = qMin(m_area.width() / size.width(), m_area.height() / size.height());
+            QSize target = (size * printPage.scale).toSize();
+            printPage.target = QRect(m_area.x() + (m_area.width() - target.width()) / 2,
+                                     m_area.y() + (m_area.height() - target.height()) / 2,
+                                     target.width(), target.height());
+            printPage.bandHeight = qMax(16, m_bandBytes / qMax(1, target.width() * 4));
+            printPage.bandCount = qMax(1, (target.height() + printPage.bandHeight - 1) / printPage.bandHeight);
+            printPage.pendingBands = printPage.bandCount;
+        }
+    }
+    return printPage;
+}
+
+/**
+ * @brief Take the next band in print order, waiting while the window
+ * of rendered but not yet printed bands is full.
+ *
+ * The first worker to reach a page loads it without holding the job
+ * lock, so the others keep rendering the bands already claimed and the
+ * printing thread keeps draining; workers needing the same page wait
+ * until it is published.
+ *
+ * @return false when there is nothing left to do.
+ */
+bool PrintJob::claimBand(int *sequence, int *pageIndex, int *band)
+{
+    QMutexLocker locker(&m_mutex);
+    forever
+    {
+        while (!m_cancelled && m_nextSequence - m_consumed >= bandWindow())
+        {
+            m_bandTaken.wait(&m_mutex);
+        }
+        if (m_cancelled || m_nextPage > m_toPage)
+        {
+            return false;
+        }
+        if (m_pages.contains(m_nextPage))
+        {
+            break;
+        }
+        if (m_loadingPage == m_nextPage)
+        {
+            m_pageLoaded.wait(&m_mutex);
+            continue;
+        }
+
+        const int loading = m_nextPage;
+        m_loadingPage = loading;
+        locker.unlock();
+        const PrintPage printPage = loadPage(loading);
+        locker.relock();
+        m_pages.insert(loading, printPage);
+        m_loadingPage = -1;
+        m_pageLoaded.wakeAll();
+    }
+    const PrintPage &printPage = m_pages[m_nextPage];
+
+    *sequence = m_nextSequence++;
+    *pageIndex = m_nextPage;
+    *band = m_nextBand++;
+    if (m_nextBand == printPage.bandCount)
+    {
+        m_nextBand = 0;
+        if (++m_nextPage > m_toPage)
+        {
+            m_totalSequences = m_nextSequence;
+        }
+    }
+    return true;
+}
+
+void PrintJob::work()
+{
+    MuPDF::ThreadScope scope(m_document);
+    int sequence, pageIndex, bandIndex;
+
+    while (claimBand(&sequence, &pageIndex, &bandIndex))
+    {
+        m_mutex.lock();
+        PrintPage printPage = m_pages.value(pageIndex);
+        m_mutex.unlock();
+
+        PrintBand band;
+        band.page = pageIndex;
+        band.position = printPage.target.topLeft() + QPoint(0, bandIndex * printPage.bandHeight);
+        band.lastOfPage = (bandIndex == printPage.bandCount - 1);
+        if (printPage.page && printPage.scale > 0.0f)
+        {
+            TRACE_SPAN("render", "PrintJob band");
+            const int top = bandIndex * printPage.bandHeight;
+            const QRect region(0, top, printPage.target.width(),
+                               qMin(printPage.bandHeight, printPage.target.height() - top));
+            // all but the last band of a page have the same size
+            band.image = m_bandPool.acquire(region.size(), QImage::Format_RGB32);
+            if (band.image.isNull()
+                    || !printPage.page->renderTo(band.image.bits(), band.image.bytesPerLine(), band.image.format(),
+                                                 region, QTransform::fromScale(printPage.scale, printPage.scale)))
+            {
+                m_bandPool.release(band.image);
+            }
+        }
+
+        QMutexLocker locker(&m_mutex);
+        m_bands.insert(sequence, band);
+        m_bandReady.wakeAll();
+        if (--m_pages[pageIndex].pendingBands == 0)
+        {
+            // drop the page on this thread, its context is still alive
+            delete m_pages.take(pageIndex).page;
+        }
+    }
+}
+
+/**
+ * @brief Spool on one worker thread, the band writers are sequential.
+ */
+bool PrintJob::execSpool()
+{
+    if (!MuPDF::Spooler::isSupported(m_spoolFormat, m_spoolMode))
+    {
+        // e.g. PCL has no 8-bit gray mode, use 1-bit instead
+        m_spoolMode = (m_spoolFormat == MuPDF::Spooler::PCL)
+                ? MuPDF::Spooler::Mono : MuPDF::Spooler::Gray;
+    }
+    m_spoolResolution = m_printer->resolution();
+    m_nextPage = m_fromPage;
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(1);
+    pool.start(new Worker(this));
+
+    const int totalPages = m_toPage - m_fromPage + 1;
+    int reported = -1;
+    bool done = false;
+    while (!done)
+    {
+        done = pool.waitForDone(50);
+        m_mutex.lock();
+        int spooled = m_spooledPages;
+        m_mutex.unlock();
+        if (spooled != reported)
+        {
+            reported = spooled;
+            emit progress(spooled, totalPages);
+        }
+        QCoreApplication::processEvents();
+    }
+
+    QMutexLocker locker(&m_mutex);
+    return !m_cancelled && m_error.isEmpty() && m_spooledPages == totalPages;
+}
+
+void PrintJob::spool()
+{
+    MuPDF::ThreadScope scope(m_document);
+    MuPDF::Spooler spooler(m_document, m_spoolFormat, m_spoolMode);
+    spooler.setResolution(m_spoolResolution);
+    QString error;
+
+    if (spooler.open(m_spoolPath))
+    {
+        for (int page = m_fromPage; page <= m_toPage; ++page)
+        {
+            m_mutex.lock();
+            bool cancelled = m_cancelled;
+            m_mutex.unlock();
+            if (cancelled)
+            {
+                break;
+            }
+            if (!spooler.writePage(page))
+            {
+                error = spooler.errorString();
+                break;
+            }
+            QMutexLocker locker(&m_mutex);
+            ++m_spooledPages;
+        }
+        if (!spooler.close() && error.isEmpty())
+        {
+            error = spooler.errorString();
+        }
+    }
+    else
+    {
+        error = spooler.errorString();
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_error = error;
+}
@@ -0,0 +1,110 @@
+#ifndef PRINTJOB_H
+#define PRINTJOB_H
+
+#include <QHash>
+#include <QImage>
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QRect>
+#include <QWaitCondition>
+#include "imagepool.h"
+#include "mupdfdocument.h"
+#include "mupdfpage.h"
+#include "mupdfspooler.h"
+
+class QPrinter;
+
+/**
+ * @brief Prints a page range of a document at the printer's resolution.
+ *
+ * Pages are rasterized in horizontal bands on worker threads while the
+ * calling thread feeds finished bands to QPainter in order, so the
+ * printer gets page n while page n+1 is being rendered. At most
+ * bandWindow() bands exist at any time, which bounds memory no matter
+ * how many pages are printed.
+ *
+ * With setSpoolOutput() the job bypasses QPrinter and streams PWG, PCL
+ * or PCLm raster data to a file or pipe instead (see MuPDF::Spooler).
+ */
+class PrintJob : public QObject
+{
+    Q_OBJECT
+
+public:
+    PrintJob(MuPDF::Document *document, QPrinter *printer, QObject *parent = NULL);
+    ~PrintJob();
+
+    void setPageRange(int fromPage, int toPage);
+    void setThreadCount(int count);
+    void setSpoolOutput(const QString &filePath, MuPDF::Spooler::Format format,
+                        MuPDF::Spooler::ColorMode mode);
+    int bandWindow() const;
+    bool exec();
+    QString errorString() const;
+
+signals:
+    void progress(int printedPages, int totalPages);
+
+public slots:
+    void cancel();
+
+private:
+    struct PrintPage
+    {
+        MuPDF::Page *page;
+        float scale;
+        QRect target;       // device pixels on the printed sheet
+        int bandHeight;
+        int bandCount;
+        int pendingBands;   // bands not rendered yet
+    };
+
+    struct PrintBand
+    {
+        int page;
+        QPoint position;    // device pixels on the printed sheet
+        bool lastOfPage;
+        QImage image;
+    };
+
+    class Worker;
+    friend class Worker;
+
+    void work();
+    bool execSpool();
+    void spool();
+    bool claimBand(int *sequence, int *pageIndex, int *band);
+    PrintPage loadPage(int pageIndex);
+
+    MuPDF::Document *m_document;
+    QPrinter *m_printer;
+    int m_fromPage;
+    int m_toPage;
+    int m_threadCount;
+    int m_bandBytes;
+    QRect m_area;           // printable area in device pixels
+    QString m_spoolPath;
+    MuPDF::Spooler::Format m_spoolFormat;
+    MuPDF::Spooler::ColorMode m_spoolMode;
+    int m_spoolResolution;
+    int m_spooledPages;
+    QString m_error;
+
+    QMutex m_mutex;
+    QWaitCondition m_bandReady;
+    QWaitCondition m_bandTaken;
+    QWaitCondition m_pageLoaded;
+    QHash<int, PrintPage> m_pages;
+    QMap<int, PrintBand> m_bands;
+    ImagePool m_bandPool;   // band buffers go back here once printed
+    int m_nextPage;         // page the next claimed band belongs to
+    int m_loadingPage;      // loaded by a worker outside the lock, -1 if none
+    int m_nextBand;
+    int m_nextSequence;
+    int m_totalSequences;   // known once the last page has been split
+    int m_consumed;
+    bool m_cancelled;
+};
+
+#endif // PRINTJOB_H
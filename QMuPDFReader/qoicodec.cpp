@@ -0,0 +1,364 @@
+#include "qoicodec.h"
+
+#include <string.h>
+
+namespace
+{
+
+enum
+{
+    OpIndex = 0x00, // 00xxxxxx
+    OpDiff = 0x40,  // 01xxxxxx
+    OpLuma = 0x80,  // 10xxxxxx
+    OpRun = 0xc0,   // 11xxxxxx
+    OpRgb = 0xfe,
+    OpRgba = 0xff,
+    OpMask = 0xc0
+};
+
+const int headerSize = 14;
+const uchar padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+// QOI's own limit, keeps every size computation within 32 bits
+const qint64 maxPixels = 400000000;
+
+struct Pixel
+{
+    uchar r, g, b, a;
+};
+
+inline bool operator==(const Pixel &x, const Pixel &y)
+{
+    return x.r == y.r && x.g == y.g && x.b == y.b && x.a == y.a;
+}
+
+inline int hashOf(const Pixel &p)
+{
+    return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64;
+}
+
+inline void writeBigEndian(uchar *out, quint32 value)
+{
+    out[0] = uchar(value >> 24);
+    out[1] = uchar(value >> 16);
+    out[2] = uchar(value >> 8);
+    out[3] = uchar(value);
+}
+
+inline quint32 readBigEndian(const uchar *in)
+{
+    return (quint32(in[0]) << 24) | (quint32(in[1]) << 16) | (quint32(in[2]) << 8) | quint32(in[3]);
+}
+
+inline Pixel pixelAt(const uchar *line, int x, bool gray)
+{
+    Pixel p;
+    if (gray)
+    {
+        p.r = p.g = p.b = line[x];
+        p.a = 255;
+    }
+    else
+    {
+        const quint32 v = reinterpret_cast<const quint32 *>(line)[x];
+        p.a = uchar(v >> 24);
+        p.r = uchar(v >> 16);
+        p.g = uchar(v >> 8);
+        p.b = uchar(v);
+    }
+    return p;
+}
+
+inline void setPixel(uchar *line, int x, const Pixel &p, bool gray)
+{
+    if (gray)
+        line[x] = p.r;
+    else
+        reinterpret_cast<quint32 *>(line)[x] = (quint32(p.a) << 24) | (quint32(p.r) << 16) | (quint32(p.g) << 8) | p.b;
+}
+
+} // end anonymous namespace
+
+namespace Qoi
+{
+
+/**
+ * @brief Encode a 32-bit (RGB32, ARGB32, ARGB32_Premultiplied) or 8-bit
+ * gray image; other formats are converted to ARGB32_Premultiplied first.
+ *
+ * @return an empty array for null images
+ */
+QByteArray encode(const QImage &image)
+{
+    QImage source = image;
+    switch (source.format())
+    {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+    case QImage::Format_Grayscale8:
+        break;
+    default:
+        source = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        break;
+    }
+    const int width = source.width();
+    const int height = source.height();
+    if (source.isNull() || qint64(width) * height > maxPixels)
+    {
+        return QByteArray();
+    }
+
+    const bool gray = (source.format() == QImage::Format_Grayscale8);
+    const bool alpha = source.hasAlphaChannel();
+
+    // worst case: one tag byte plus four channels per pixel
+    QByteArray data;
+    data.resize(int(headerSize + qint64(width) * height * (alpha ? 5 : 4) + sizeof(padding)));
+    uchar *out = reinterpret_cast<uchar *>(data.data());
+
+    memcpy(out, "qoif", 4);
+    writeBigEndian(out + 4, quint32(width));
+    writeBigEndian(out + 8, quint32(height));
+    out[12] = alpha ? 4 : 3;
+    out[13] = 0;
+    int pos = headerSize;
+
+    Pixel index[64];
+    memset(index, 0, sizeof(index));
+    Pixel previous = { 0, 0, 0, 255 };
+    int run = 0;
+
+    for (int y = 0; y < height; ++y)
+    {
+        const uchar *line = source.constScanLine(y);
+        for (int x = 0; x < width; ++x)
+        {
+            Pixel p = pixelAt(line, x, gray);
+            if (!alpha)
+                p.a = 255;
+
+            if (p == previous)
+            {
+                if (++run == 62)
+                {
+                    out[pos++] = uchar(OpRun | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0)
+            {
+                out[pos++] = uchar(OpRun | (run - 1));
+                run = 0;
+            }
+
+            const int hash = hashOf(p);
+            if (index[hash] == p)
+            {
+                out[pos++] = uchar(OpIndex | hash);
+            }
+            else
+            {
+                index[hash] = p;
+                if (p.a == previous.a)
+                {
+                    const int vr = int(p.r) - previous.r;
+                    const int vg = int(p.g) - previous.g;
+                    const int vb = int(p.b) - previous.b;
+                    // differences wrap around like in every QOI coder
+                    const signed char dr = static_cast<signed char>(vr);
+                    const signed char dg = static_cast<signed char>(vg);
+                    const signed char db = static_cast<signed char>(vb);
+                    const int dgr = dr - dg;
+                    const int dgb = db - dg;
+                    if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2)
+                    {
+                        out[pos++] = uchar(OpDiff | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+                    }
+                    else if (dgr > -9 && dgr < 8 && dg > -33 && dg < 32 && dgb > -9 && dgb < 8)
+                    {
+                        out[pos++] = uchar(OpLuma | (dg + 32));
+                        out[pos++] = uchar(((dgr + 8) << 4) | (dgb + 8));
+                    }
+                    else
+                    {
+                        out[pos++] = OpRgb;
+                        out[pos++] = p.r;
+                        out[pos++] = p.g;
+                        out[pos++] = p.b;
+                    }
+                }
+                else
+                {
+                    out[pos++] = OpRgba;
+                    out[pos++] = p.r;
+                    out[pos++] = p.g;
+                    out[pos++] = p.b;
+                    out[pos++] = p.a;
+                }
+            }
+            previous = p;
+        }
+    }
+    if (run > 0)
+    {
+        out[pos++] = uchar(OpRun | (run - 1));
+    }
+
+    memcpy(out + pos, padding, sizeof(padding));
+    pos += sizeof(padding);
+    data.resize(pos);
+    return data;
+}
+
+/**
+ * @brief Decode QOI data, e.g. straight from a mapped file.
+ *
+ * @param format Format_RGB32, Format_ARGB32_Premultiplied or
+ *               Format_Grayscale8 (which keeps the red channel)
+ *
+ * @return a null image if the data is invalid or truncated
+ */
+QImage decode(const uchar *data, qint64 size, QImage::Format format)
+{
+    if (!data || size < headerSize + qint64(sizeof(padding)) || memcmp(data, "qoif", 4) != 0)
+    {
+        return QImage();
+    }
+    const quint32 width = readBigEndian(data + 4);
+    const quint32 height = readBigEndian(data + 8);
+    if (width == 0 || height == 0 || qint64(width) * height > maxPixels)
+    {
+        return QImage();
+    }
+
+    QImage image(int(width), int(height), format);
+    if (image.isNull())
+    {
+        return image;
+    }
+    const bool gray = (format == QImage::Format_Grayscale8);
+
+    Pixel index[64];
+    memset(index, 0, sizeof(index));
+    Pixel p = { 0, 0, 0, 255 };
+    int run = 0;
+    const qint64 end = size - sizeof(padding);
+    qint64 pos = headerSize;
+
+    for (int y = 0; y < int(height); ++y)
+    {
+        uchar *line = image.scanLine(y);
+        for (int x = 0; x < int(width); ++x)
+        {
+            if (run > 0)
+            {
+                --run;
+            }
+            else if (pos < end)
+            {
+                const int tag = data[pos++];
+                if (tag == OpRgb)
+                {
+                    if (pos + 3 > end)
+                        return QImage();
+                    p.r = data[pos++];
+                    p.g = data[pos++];
+                    p.b = data[pos++];
+                }
+                else if (tag == OpRgba)
+                {
+                    if (pos + 4 > end)
+                        return QImage();
+                    p.r = data[pos++];
+                    p.g = data[pos++];
+                    p.b = data[pos++];
+                    p.a = data[pos++];
+                }
+                else if ((tag & OpMask) == OpIndex)
+                {
+                    p = index[tag];
+                }
+                else if ((tag & OpMask) == OpDiff)
+                {
+                    p.r += ((tag >> 4) & 0x03) - 2;
+                    p.g += ((tag >> 2) & 0x03) - 2;
+                    p.b += (tag & 0x03) - 2;
+                }
+                else if ((tag & OpMask) == OpLuma)
+                {
+                    if (pos + 1 > end)
+                        return QImage();
+                    const int next = data[pos++];
+                    const int dg = (tag & 0x3f) - 32;
+                    p.r += dg - 8 + ((next >> 4) & 0x0f);
+                    p.g += dg;
+                    p.b += dg - 8 + (next & 0x0f);
+                }
+                else
+                {
+                    run = tag & 0x3f;
+                }
+                index[hashOf(p)] = p;
+            }
+            else
+            {
+                return QImage();
+            }
+            setPixel(line, x, p, gray);
+        }
+    }
+    return image;
+}
+
+/**
+ * @brief Encode and tag the data with the image format, for caches that
+ * have to give back exactly what they got.
+ *
+ * @return an empty array unless the image is RGB32,
+ *         ARGB32_Premultiplied or Grayscale8
+ */
+QByteArray pack(const QImage &image)
+{
+    char tag;
+    switch (image.format())
+    {
+    case QImage::Format_RGB32:
+        tag = 'C';
+        break;
+    case QImage::Format_ARGB32_Premultiplied:
+        tag = 'A';
+        break;
+    case QImage::Format_Grayscale8:
+        tag = 'G';
+        break;
+    default:
+        return QByteArray();
+    }
+    const QByteArray data = encode(image);
+    return data.isEmpty() ? data : tag + data;
+}
+
+/**
+ * @brief Decode data written by pack().
+ */
+QImage unpack(const uchar *data, qint64 size)
+{
+    if (!data || size < 1)
+    {
+        return QImage();
+    }
+    switch (data[0])
+    {
+    case 'C':
+        return decode(data + 1, size - 1, QImage::Format_RGB32);
+    case 'A':
+        return decode(data + 1, size - 1, QImage::Format_ARGB32_Premultiplied);
+    case 'G':
+        return decode(data + 1, size - 1, QImage::Format_Grayscale8);
+    default:
+        return QImage();
+    }
+}
+
+} // end namespace Qoi
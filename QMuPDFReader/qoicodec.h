@@ -0,0 +1,28 @@
+#ifndef QOICODEC_H
+#define QOICODEC_H
+
+#include <QByteArray>
+#include <QImage>
+
+/**
+ * @brief "Quite OK Image" lossless codec, see https://qoiformat.org.
+ *
+ * Encodes several times faster than PNG at a similar size for rendered
+ * pages (long runs of paper color, small differences along glyph edges),
+ * and decodes straight from a memory-mapped file.
+ *
+ * Pixels are stored as they are in the QImage: premultiplied images keep
+ * premultiplied values, so they round-trip exactly.
+ */
+namespace Qoi
+{
+
+QByteArray encode(const QImage &image);
+QImage decode(const uchar *data, qint64 size, QImage::Format format);
+
+QByteArray pack(const QImage &image);
+QImage unpack(const uchar *data, qint64 size);
+
+} // end namespace Qoi
+
+#endif // QOICODEC_H
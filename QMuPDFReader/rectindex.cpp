@@ -0,0 +1,169 @@
+#include "rectindex.h"
+
+#include <QPair>
+
+#include <algorithm>
+#include <cmath>
+
+// children per node
+static const int NodeSize = 16;
+
+RectIndex::RectIndex()
+{
+}
+
+/**
+ * @brief Replace the index contents; the id of a rect is its position in
+ * @p rects.
+ */
+void RectIndex::build(const QVector<QRectF> &rects)
+{
+    clear();
+    const int count = rects.size();
+    if (count == 0)
+    {
+        return;
+    }
+
+    m_rects.resize(count);
+    QVector<int> order(count);
+    for (int i = 0; i < count; ++i)
+    {
+        const QRectF r = rects.at(i).normalized();
+        Box box = { float(r.left()), float(r.top()), float(r.right()), float(r.bottom()) };
+        m_rects[i] = box;
+        order[i] = i;
+    }
+
+    // sort-tile-recursive: vertical slices by center x, then by center y
+    // inside a slice, so every leaf node covers a compact tile
+    const Box *boxes = m_rects.constData();
+    std::sort(order.begin(), order.end(), [boxes](int a, int b) {
+        return boxes[a].x0 + boxes[a].x1 < boxes[b].x0 + boxes[b].x1;
+    });
+    const int leaves = (count + NodeSize - 1) / NodeSize;
+    const int slices = int(std::ceil(std::sqrt(double(leaves))));
+    const int sliceSize = slices * NodeSize;
+    for (int first = 0; first < count; first += sliceSize)
+    {
+        const int last = qMin(first + sliceSize, count);
+        std::sort(order.begin() + first, order.begin() + last, [boxes](int a, int b) {
+            return boxes[a].y0 + boxes[a].y1 < boxes[b].y0 + boxes[b].y1;
+        });
+    }
+
+    m_leafIds = order;
+    m_boxes.reserve(count + count / (NodeSize - 1) + 1);
+    for (int i = 0; i < count; ++i)
+    {
+        m_boxes.append(m_rects.at(order.at(i)));
+    }
+
+    // parent levels until a single root
+    m_levelStart.append(0);
+    int levelBegin = 0;
+    int levelEnd = count;
+    while (levelEnd - levelBegin > 1)
+    {
+        m_levelStart.append(levelEnd);
+        for (int child = levelBegin; child < levelEnd; child += NodeSize)
+        {
+            Box node = m_boxes.at(child);
+            const int last = qMin(child + NodeSize, levelEnd);
+            for (int i = child + 1; i < last; ++i)
+            {
+                const Box &b = m_boxes.at(i);
+                node.x0 = qMin(node.x0, b.x0);
+                node.y0 = qMin(node.y0, b.y0);
+                node.x1 = qMax(node.x1, b.x1);
+                node.y1 = qMax(node.y1, b.y1);
+            }
+            m_boxes.append(node);
+        }
+        levelBegin = levelEnd;
+        levelEnd = m_boxes.size();
+    }
+    m_levelStart.append(m_boxes.size());
+}
+
+void RectIndex::clear()
+{
+    m_rects.clear();
+    m_boxes.clear();
+    m_leafIds.clear();
+    m_levelStart.clear();
+}
+
+bool RectIndex::isEmpty() const
+{
+    return m_rects.isEmpty();
+}
+
+int RectIndex::size() const
+{
+    return m_rects.size();
+}
+
+QRectF RectIndex::rect(int id) const
+{
+    const Box &box = m_rects.at(id);
+    return QRectF(QPointF(box.x0, box.y0), QPointF(box.x1, box.y1));
+}
+
+/**
+ * @brief Ids of the rects overlapping @p rect, ascending.
+ */
+QVector<int> RectIndex::intersecting(const QRectF &rect) const
+{
+    const QRectF r = rect.normalized();
+    Box box = { float(r.left()), float(r.top()), float(r.right()), float(r.bottom()) };
+    QVector<int> ids;
+    query(box, &ids);
+    return ids;
+}
+
+/**
+ * @brief Ids of the rects containing @p point (edges included), ascending.
+ */
+QVector<int> RectIndex::containing(const QPointF &point) const
+{
+    Box box = { float(point.x()), float(point.y()), float(point.x()), float(point.y()) };
+    QVector<int> ids;
+    query(box, &ids);
+    return ids;
+}
+
+void RectIndex::query(const Box &box, QVector<int> *ids) const
+{
+    if (m_boxes.isEmpty())
+    {
+        return;
+    }
+
+    // pending nodes as (level, position inside the level)
+    QVector<QPair<int, int> > stack;
+    const int rootLevel = m_levelStart.size() - 2;
+    stack.append(qMakePair(rootLevel, 0));
+    while (!stack.isEmpty())
+    {
+        const QPair<int, int> node = stack.takeLast();
+        const Box &b = m_boxes.at(m_levelStart.at(node.first) + node.second);
+        if (b.x1 < box.x0 || b.x0 > box.x1 || b.y1 < box.y0 || b.y0 > box.y1)
+        {
+            continue;
+        }
+        if (node.first == 0)
+        {
+            ids->append(m_leafIds.at(node.second));
+            continue;
+        }
+        const int childLevel = node.first - 1;
+        const int childCount = m_levelStart.at(node.first) - m_levelStart.at(childLevel);
+        const int last = qMin((node.second + 1) * NodeSize, childCount);
+        for (int child = node.second * NodeSize; child < last; ++child)
+        {
+            stack.append(qMakePair(childLevel, child));
+        }
+    }
+    std::sort(ids->begin(), ids->end());
+}
@@ -0,0 +1,46 @@
+#ifndef RECTINDEX_H
+#define RECTINDEX_H
+
+#include <QPointF>
+#include <QRectF>
+#include <QVector>
+
+/**
+ * @brief Static packed R-tree over rectangles, for point and rect queries
+ * on page geometry (characters, links, annotations).
+ *
+ * build() sorts the rectangles into tiles (sort-tile-recursive) and packs
+ * a tree of 16 children per node into flat arrays; queries only descend
+ * into nodes overlapping the query, so a hit test touches a few dozen
+ * boxes instead of every character of the page. The tree is immutable,
+ * build it again when the geometry changes.
+ */
+class RectIndex
+{
+public:
+    RectIndex();
+
+    void build(const QVector<QRectF> &rects);
+    void clear();
+    bool isEmpty() const;
+    int size() const;
+    QRectF rect(int id) const;
+
+    QVector<int> intersecting(const QRectF &rect) const;
+    QVector<int> containing(const QPointF &point) const;
+
+private:
+    struct Box
+    {
+        float x0, y0, x1, y1;
+    };
+
+    void query(const Box &box, QVector<int> *ids) const;
+
+    QVector<Box> m_rects;       // by id
+    QVector<Box> m_boxes;       // all levels, leaves first
+    QVector<int> m_leafIds;     // id of each leaf box
+    QVector<int> m_levelStart;  // first box of each level, plus the end
+};
+
+#endif // RECTINDEX_H
@@ -0,0 +1,63 @@
+#include "savejob.h"
+#include "tracing.h"
+
+/**
+ * @param document must outlive the job
+ */
+SaveJob::SaveJob(MuPDF::Document *document, const QString &filePath,
+                 MuPDF::SaveMode mode, QObject *parent)
+    : QThread(parent)
+    , m_document(document)
+    , m_filePath(filePath)
+    , m_mode(mode)
+    , m_cancelled(0)
+    , m_saved(false)
+{
+}
+
+/**
+ * @brief Cancels a running save and waits for it.
+ */
+SaveJob::~SaveJob()
+{
+    cancel();
+    wait();
+}
+
+/**
+ * @brief Whether the document was saved, valid once the thread finished.
+ */
+bool SaveJob::isSaved() const
+{
+    return m_saved;
+}
+
+QString SaveJob::errorString() const
+{
+    return m_error;
+}
+
+/**
+ * @brief Stop at the next progress report; the file is left as it was.
+ */
+void SaveJob::cancel()
+{
+    m_cancelled.storeRelease(1);
+}
+
+void SaveJob::run()
+{
+    TRACE_SPAN("io", "SaveJob::run");
+    MuPDF::ThreadScope scope(m_document);
+    m_saved = m_document->save(m_filePath, m_mode, this);
+    m_error = (m_saved || m_cancelled.loadAcquire()) ? QString() : m_document->errorString();
+}
+
+bool SaveJob::saveProgress(qint64 written, qint64 expected)
+{
+    if (expected > 0)
+    {
+        emit progress(int(qMin<qint64>(100, written * 100 / expected)));
+    }
+    return !m_cancelled.loadAcquire();
+}
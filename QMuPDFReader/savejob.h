@@ -0,0 +1,47 @@
+#ifndef SAVEJOB_H
+#define SAVEJOB_H
+
+#include <QAtomicInt>
+#include <QString>
+#include <QThread>
+#include "mupdfdocument.h"
+
+/**
+ * @brief Saves a document on a worker thread, see MuPDF::Document::save().
+ *
+ * progress() is only emitted for full rewrites; incremental saves write
+ * little more than the edits and finish quickly.
+ */
+class SaveJob : public QThread, private MuPDF::SaveProgress
+{
+    Q_OBJECT
+
+public:
+    SaveJob(MuPDF::Document *document, const QString &filePath,
+            MuPDF::SaveMode mode = MuPDF::SaveIncremental, QObject *parent = NULL);
+    ~SaveJob();
+
+    bool isSaved() const;
+    QString errorString() const;
+
+signals:
+    void progress(int percent);
+
+public slots:
+    void cancel();
+
+protected:
+    void run();
+
+private:
+    bool saveProgress(qint64 written, qint64 expected);
+
+    MuPDF::Document *m_document;
+    QString m_filePath;
+    MuPDF::SaveMode m_mode;
+    QAtomicInt m_cancelled;
+    bool m_saved;
+    QString m_error;
+};
+
+#endif // SAVEJOB_H
@@ -1,48 +1,103 @@
 #include "pagerender.h"
 #include "sequentialpagewidget.h"
+#include "tracing.h"
+#include <QApplication>
+#include <QClipboard>
+#include <QDesktopServices>
+#include <QGestureEvent>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QMoveEvent>
+#include <QWheelEvent>
+#include <QUrl>
+#include <QtMath>
 #include <QPaintEvent>
 #include <QPainter>
 #include <QGuiApplication>
 #include <QScreen>
 #include <QDebug>
 
+#include <algorithm>
+
 SequentialPageWidget::SequentialPageWidget(QWidget *parent)
     : QWidget(parent)
     , m_pageCacheLimit(9)
+    , m_interacting(false)
+    , m_zooming(false)
+    , m_showAnnotations(true)
     , m_PageRender(new PageRender())
     , m_pageSpacing(8)
     , m_pageIndex(0)
     , m_totalPages(0)
     , m_zoom(1.)
     , m_screenResolution(QGuiApplication::primaryScreen()->logicalDotsPerInch() / 72)
+    , m_devicePixelRatio(1.0)
+    , m_colorEffect(MuPDF::NoEffect)
     , m_placeholderIcon(":/new/images/busy.png")
+    , m_editPage(NULL)
+    , m_editPageIndex(-1)
+    , m_editField(-1)
+    , m_pressedLink(-1)
+    , m_pressedLinkPage(-1)
+    , m_selectionPage(-1)
+    , m_selecting(false)
     , m_document(NULL)
 {
   //  qDebug() << QGuiApplication::primaryScreen()->logicalDotsPerInch();
-    connect(m_PageRender, SIGNAL(pageReady(int, qreal, QImage)), this, SLOT(pageLoaded(int, qreal, QImage)), Qt::QueuedConnection);
+    connect(m_PageRender, SIGNAL(pageReady(int, qreal, QImage, bool, int)), this, SLOT(pageLoaded(int, qreal, QImage, bool, int)), Qt::QueuedConnection);
+    connect(m_PageRender, SIGNAL(annotationsReady(int, qreal, QImage, int)), this, SLOT(annotationsLoaded(int, qreal, QImage, int)), Qt::QueuedConnection);
+    m_zoomTimer.setSingleShot(true);
+    m_zoomTimer.setInterval(150);
+    connect(&m_zoomTimer, SIGNAL(timeout()), this, SLOT(zoomSettled()));
+    grabGesture(Qt::PinchGesture);
+    m_idleTimer.setSingleShot(true);
+    m_idleTimer.setInterval(250);
+    connect(&m_idleTimer, SIGNAL(timeout()), this, SLOT(interactionFinished()));
     grabGesture(Qt::SwipeGesture);
+    setFocusPolicy(Qt::ClickFocus);
+    // hover cursor over text and links
+    setMouseTracking(true);
+    MemoryGovernor::instance()->addConsumer(this, MemoryGovernor::RawImages);
+    MemoryGovernor::instance()->addConsumer(&m_compressedPages, MemoryGovernor::CompressedImages);
 }
 
 SequentialPageWidget::~SequentialPageWidget()
 {
+    MemoryGovernor::instance()->removeConsumer(this);
+    MemoryGovernor::instance()->removeConsumer(&m_compressedPages);
+    finishEditing();
+    clearSelection();
+    clearGeometryPages();
     delete m_PageRender;
 }
 
 bool SequentialPageWidget::setDocument(const QString &filePath)
 {
-    m_document = MuPDF::loadDocument(filePath);
-    if (NULL == m_document)
+    MuPDF::Document *document = MuPDF::loadDocument(filePath);
+    if (NULL == document)
     {
         return false;
     }
 
-    m_PageRender->setDocument(m_document);
+    // text pages take a quarter of the memory as 8-bit gray
+    document->setRenderMode(MuPDF::RenderAuto);
+    document->setColorEffect(m_colorEffect);
+
+    finishEditing();
+    clearSelection();
+    clearGeometryPages();
+    // the renderer is idle on the new document before the old one goes
+    m_PageRender->setDocument(document);
+    delete m_document;
+    m_document = document;
     m_totalPages = m_document->numPages();
     m_pageSizes.clear();
 
     for (int page = 0; page < m_document->numPages(); ++page)
     {
-         m_pageSizes.append(m_document->page(page)->size()*m_screenResolution);
+        MuPDF::Page *objpage = m_document->page(page);
+        m_pageSizes.append(objpage ? objpage->size() * m_screenResolution : QSizeF());
+        delete objpage;
     }
 
     invalidate();
@@ -118,28 +173,561 @@ void SequentialPageWidget::goToPage(int page)
 
 void SequentialPageWidget::zoomIn()
 {
-    if (m_zoom < 10.0f)
+    setZoom(m_zoom + 0.1);
+}
+
+void SequentialPageWidget::zoomOut()
+{
+    setZoom(m_zoom - 0.1);
+}
+
+/**
+ * @brief Zoom continuously, e.g. from a pinch gesture or ctrl+wheel.
+ *
+ * While the zoom keeps changing, the images rendered so far are scaled
+ * when painting and nothing is rendered. Once it settles, the zoom snaps
+ * to the nearest 5% step and the visible pages are rendered again.
+ *
+ * @param zoom 0.1 to 10
+ */
+void SequentialPageWidget::setZoom(qreal zoom)
+{
+    zoom = qBound(0.1, zoom, 10.0);
+    if (qFuzzyCompare(zoom, m_zoom))
     {
-        m_zoom += 0.1f;
-        invalidate();
+        return;
+    }
+    if (!m_zooming)
+    {
+        m_zooming = true;
+        keepPreviews();
     }
+    m_zoom = zoom;
+    m_zoomTimer.start();
+    updateLayout();
+    update();
+    emit updatePdfInfo(m_pageIndex, m_totalPages, m_zoom);
 }
 
-void SequentialPageWidget::zoomOut()
+qreal SequentialPageWidget::zoom() const
 {
-    if (m_zoom > 0.1f)
+    return m_zoom;
+}
+
+/**
+ * @brief Scale pages are rendered at: physical pixels, so they are sharp
+ * on high-DPI screens and the cache keys differ per device pixel ratio.
+ */
+qreal SequentialPageWidget::renderZoom() const
+{
+    return m_screenResolution * m_zoom * m_devicePixelRatio;
+}
+
+/**
+ * @brief Follow the window to a screen with another device pixel ratio;
+ * the visible pages are scaled until they are rendered again.
+ */
+void SequentialPageWidget::updateDevicePixelRatio()
+{
+    const qreal ratio = devicePixelRatioF();
+    if (!qFuzzyCompare(ratio, m_devicePixelRatio))
     {
-        m_zoom -= 0.1f;
+        m_devicePixelRatio = ratio;
+        keepPreviews();
+    }
+}
+
+void SequentialPageWidget::zoomSettled()
+{
+    m_zooming = false;
+    m_zoom = qBound(0.1, qRound(m_zoom * 20) / 20.0, 10.0);
+    // render in full quality right away, nothing was drawn meanwhile
+    m_interacting = false;
+    m_idleTimer.stop();
+    updateLayout();
+    update();
+    emit updatePdfInfo(m_pageIndex, m_totalPages, m_zoom);
+}
+
+/**
+ * @brief Keep the images of the visible pages as previews, scaled to the
+ * new zoom until the pages are rendered again, and drop all caches.
+ */
+void SequentialPageWidget::keepPreviews()
+{
+    const QRect visible = visibleRegion().boundingRect();
+    QHash<int, QImage> previews;
+    QHash<int, QImage> annotations;
+    int y = m_pageSpacing;
+    for (int page = 0; page < m_totalPages && y <= visible.bottom(); ++page)
+    {
+        const int height = pageSize(page).toSize().height();
+        if (y + height >= visible.top())
+        {
+            if (m_pageCache.contains(page))
+                previews.insert(page, m_pageCache.value(page));
+            else if (m_previewPages.contains(page))
+                previews.insert(page, m_previewPages.value(page));
+            if (m_annotationLayers.contains(page))
+                annotations.insert(page, m_annotationLayers.value(page));
+            else if (m_previewAnnotations.contains(page))
+                annotations.insert(page, m_previewAnnotations.value(page));
+        }
+        y += height + m_pageSpacing;
+    }
+    m_previewPages = previews;
+    m_previewAnnotations = annotations;
+
+    m_pageCache.clear();
+    m_cachedPagesLRU.clear();
+    m_compressedPages.clear();
+    m_draftPages.clear();
+    m_annotationLayers.clear();
+}
+
+bool SequentialPageWidget::event(QEvent *event)
+{
+    if (event->type() == QEvent::Gesture)
+    {
+        QGestureEvent *gestureEvent = static_cast<QGestureEvent *>(event);
+        if (QPinchGesture *pinch = static_cast<QPinchGesture *>(gestureEvent->gesture(Qt::PinchGesture)))
+        {
+            if (pinch->changeFlags() & QPinchGesture::ScaleFactorChanged)
+            {
+                setZoom(m_zoom * pinch->scaleFactor());
+            }
+            gestureEvent->accept(pinch);
+            return true;
+        }
+    }
+    return QWidget::event(event);
+}
+
+void SequentialPageWidget::wheelEvent(QWheelEvent *event)
+{
+    if (!(event->modifiers() & Qt::ControlModifier))
+    {
+        // let the scroll area scroll
+        event->ignore();
+        return;
+    }
+    // one notch (120) zooms by about 20%
+    setZoom(m_zoom * qPow(1.0015, event->angleDelta().y()));
+    event->accept();
+}
+
+void SequentialPageWidget::setColorEffect(MuPDF::ColorEffect effect)
+{
+    m_colorEffect = effect;
+    if (m_document)
+    {
+        // pages pick the effect up when they are rendered again; renders
+        // still running with the old effect are dropped by the generation
+        m_document->setColorEffect(effect);
+        m_PageRender->invalidate();
         invalidate();
     }
 }
 
+/**
+ * @brief The render scheduler, shared with the thumbnail sidebar.
+ */
+PageRender *SequentialPageWidget::pageRender() const
+{
+    return m_PageRender;
+}
+
+MuPDF::ColorEffect SequentialPageWidget::colorEffect() const
+{
+    return m_colorEffect;
+}
+
+/**
+ * @brief Show or hide annotations. They are a separate layer drawn over
+ * the pages, so no page is rendered again.
+ */
+void SequentialPageWidget::setShowAnnotations(bool show)
+{
+    if (show != m_showAnnotations)
+    {
+        m_showAnnotations = show;
+        update();
+    }
+}
+
+bool SequentialPageWidget::showAnnotations() const
+{
+    return m_showAnnotations;
+}
+
+/**
+ * @brief Render the annotation layer of @p page again, e.g. after its
+ * annotations were edited. The old layer stays visible until the new one
+ * arrives, the page image is kept.
+ */
+void SequentialPageWidget::reloadAnnotations(int page)
+{
+    if (m_document && page >= 0 && page < m_totalPages)
+    {
+        m_PageRender->requestAnnotations(page, renderZoom(), true);
+    }
+}
+
 QSizeF SequentialPageWidget::pageSize(int page)
 {
     return m_pageSizes.value(page) * m_zoom;
 }
 
+/**
+ * @brief Where paintEvent() draws @p page.
+ */
+QRectF SequentialPageWidget::pageRect(int page)
+{
+    const QSizeF size = pageSize(page);
+    return QRectF((width() - size.width()) / 2, m_pageOffsets.value(page, m_pageSpacing), size.width(), size.height());
+}
+
+/**
+ * @brief The page under @p pos, -1 if there is none.
+ *
+ * @param point receives @p pos in points on that page
+ */
+int SequentialPageWidget::pageAt(const QPoint &pos, QPointF *point)
+{
+    if (!m_document || m_pageOffsets.isEmpty())
+    {
+        return -1;
+    }
+    // last page starting above pos
+    const int page = int(std::upper_bound(m_pageOffsets.constBegin(), m_pageOffsets.constEnd(), pos.y())
+                         - m_pageOffsets.constBegin()) - 1;
+    if (page < 0)
+    {
+        return -1;
+    }
+    const QRectF rect = pageRect(page);
+    if (!rect.contains(pos))
+    {
+        return -1;
+    }
+    *point = (pos - rect.topLeft()) / (m_screenResolution * m_zoom);
+    return page;
+}
+
+/**
+ * @brief The page for hit tests, loaded when the mouse first gets over it.
+ *
+ * The last few pages are kept with their resolved links and spatial
+ * indexes, so links are only loaded for pages the user looks at, never
+ * for the whole document.
+ */
+MuPDF::Page *SequentialPageWidget::geometryPage(int page)
+{
+    MuPDF::Page *objpage = m_geometryPages.value(page);
+    if (!objpage)
+    {
+        // hit tests need no display list, the text is extracted once
+        objpage = m_document->page(page, false);
+        if (!objpage)
+        {
+            return NULL;
+        }
+        m_geometryPages.insert(page, objpage);
+    }
+    m_geometryPagesLRU.removeOne(page);
+    m_geometryPagesLRU.append(page);
+    while (m_geometryPagesLRU.size() > 4)
+    {
+        delete m_geometryPages.take(m_geometryPagesLRU.takeFirst());
+    }
+    return objpage;
+}
+
+void SequentialPageWidget::clearGeometryPages()
+{
+    qDeleteAll(m_geometryPages);
+    m_geometryPages.clear();
+    m_geometryPagesLRU.clear();
+    m_pressedLink = -1;
+    m_pressedLinkPage = -1;
+}
+
+/**
+ * @brief Jump to the destination of an internal link, the offset of its
+ * page comes from the layout; external links open in the browser.
+ */
+void SequentialPageWidget::followLink(const MuPDF::Link &link)
+{
+    if (link.page < 0)
+    {
+        if (!link.uri.isEmpty())
+            QDesktopServices::openUrl(QUrl(link.uri));
+        return;
+    }
+    if (link.page >= m_totalPages)
+    {
+        return;
+    }
+    goToPage(link.page);
+    const qreal y = pageRect(link.page).top() + link.target.y() * m_screenResolution * m_zoom;
+    emit scrollRequested(qMax(0, qRound(y) - m_pageSpacing));
+}
+
+void SequentialPageWidget::clearSelection()
+{
+    if (m_selectionPage >= 0)
+    {
+        m_selectionPage = -1;
+        m_selectionRects.clear();
+        update();
+    }
+    m_selecting = false;
+}
+
+/**
+ * @brief Shift+drag selects text on a page, Ctrl+C copies it; clicking a
+ * link follows it. Other presses go to the parent, which scrolls by
+ * dragging.
+ */
+void SequentialPageWidget::mousePressEvent(QMouseEvent *event)
+{
+    clearSelection();
+    m_pressedLink = -1;
+    QPointF point;
+    const int page = (event->button() == Qt::LeftButton) ? pageAt(event->pos(), &point) : -1;
+    MuPDF::Page *objpage = (page >= 0) ? geometryPage(page) : NULL;
+    if (!objpage)
+    {
+        QWidget::mousePressEvent(event);
+        return;
+    }
+    if (!(event->modifiers() & Qt::ShiftModifier))
+    {
+        m_pressedLink = objpage->linkAt(point);
+        m_pressedLinkPage = page;
+        if (m_pressedLink < 0)
+        {
+            QWidget::mousePressEvent(event);
+            return;
+        }
+        event->accept();
+        return;
+    }
+    m_selectionPage = page;
+    m_selecting = true;
+    m_selectionStart = point;
+    m_selectionEnd = point;
+    event->accept();
+}
+
+void SequentialPageWidget::mouseMoveEvent(QMouseEvent *event)
+{
+    if (m_selecting)
+    {
+        const QRectF rect = pageRect(m_selectionPage);
+        m_selectionEnd = (event->pos() - rect.topLeft()) / (m_screenResolution * m_zoom);
+        m_selectionRects = geometryPage(m_selectionPage)->textRects(QRectF(m_selectionStart, m_selectionEnd).normalized());
+        update();
+        event->accept();
+        return;
+    }
+
+    if (event->buttons() == Qt::NoButton)
+    {
+        QPointF point;
+        const int page = pageAt(event->pos(), &point);
+        MuPDF::Page *objpage = (page >= 0) ? geometryPage(page) : NULL;
+        if (objpage && objpage->linkAt(point) >= 0)
+            setCursor(Qt::PointingHandCursor);
+        else if (objpage && objpage->hasTextAt(point))
+            setCursor(Qt::IBeamCursor);
+        else
+            unsetCursor();
+    }
+    QWidget::mouseMoveEvent(event);
+}
+
+void SequentialPageWidget::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (m_selecting)
+    {
+        m_selecting = false;
+        event->accept();
+        return;
+    }
+    if (m_pressedLink >= 0)
+    {
+        // follow the link if the mouse is still on it
+        QPointF point;
+        const int link = m_pressedLink;
+        m_pressedLink = -1;
+        MuPDF::Page *objpage = geometryPage(m_pressedLinkPage);
+        if (objpage && pageAt(event->pos(), &point) == m_pressedLinkPage && objpage->linkAt(point) == link)
+        {
+            followLink(objpage->links().at(link));
+        }
+        event->accept();
+        return;
+    }
+    QWidget::mouseReleaseEvent(event);
+}
+
+/**
+ * @brief Double clicking a text form field starts typing into it; keys go
+ * to the field until Return, Escape or a click elsewhere.
+ */
+void SequentialPageWidget::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    finishEditing();
+    for (int page = 0; m_document && page < m_totalPages; ++page)
+    {
+        const QRectF rect = pageRect(page);
+        if (rect.top() > event->pos().y())
+        {
+            break;
+        }
+        if (!rect.contains(event->pos()))
+        {
+            continue;
+        }
+
+        // only the form fields are needed, skip the page contents
+        m_editPage = m_document->page(page, false);
+        if (!m_editPage)
+        {
+            break;
+        }
+        const QPointF point = (event->pos() - rect.topLeft()) / (m_screenResolution * m_zoom);
+        const QVector<QRectF> fields = m_editPage->textFields();
+        for (int field = 0; field < fields.size(); ++field)
+        {
+            if (fields.at(field).contains(point))
+            {
+                m_editPageIndex = page;
+                m_editField = field;
+                m_editFieldRect = fields.at(field);
+                m_editText = m_editPage->textFieldValue(field);
+                update();
+                event->accept();
+                return;
+            }
+        }
+        finishEditing();
+        break;
+    }
+    QWidget::mouseDoubleClickEvent(event);
+}
+
+void SequentialPageWidget::keyPressEvent(QKeyEvent *event)
+{
+    if (m_editField < 0)
+    {
+        if (event->matches(QKeySequence::Copy) && m_selectionPage >= 0)
+        {
+            const QString text = geometryPage(m_selectionPage)->text(QRectF(m_selectionStart, m_selectionEnd).normalized());
+            QApplication::clipboard()->setText(text);
+            event->accept();
+            return;
+        }
+        QWidget::keyPressEvent(event);
+        return;
+    }
+
+    switch (event->key())
+    {
+    case Qt::Key_Return:
+    case Qt::Key_Enter:
+    case Qt::Key_Escape:
+        finishEditing();
+        break;
+    case Qt::Key_Backspace:
+        m_editText.chop(1);
+        editTextField();
+        break;
+    default:
+        if (event->text().isEmpty() || !event->text().at(0).isPrint())
+        {
+            QWidget::keyPressEvent(event);
+            return;
+        }
+        m_editText += event->text();
+        editTextField();
+        break;
+    }
+    event->accept();
+}
+
+void SequentialPageWidget::focusOutEvent(QFocusEvent *event)
+{
+    finishEditing();
+    QWidget::focusOutEvent(event);
+}
+
+/**
+ * @brief Store the typed text in the field and patch only the dirty rects
+ * of the annotation layer; the page image stays as it is.
+ */
+void SequentialPageWidget::editTextField()
+{
+    TRACE_SPAN("paint", "SequentialPageWidget::editTextField");
+    if (!m_editPage->setTextFieldValue(m_editField, m_editText))
+    {
+        return;
+    }
+
+    const int page = m_editPageIndex;
+    const QVector<QRectF> dirty = m_editPage->takeDirtyRects();
+    m_previewAnnotations.remove(page);
+    // taken out of the hash, so patching does not copy the layer
+    QImage layer = m_annotationLayers.take(page);
+    bool patched = !layer.isNull();
+    foreach (const QRectF &rect, dirty)
+    {
+        patched = patched && m_editPage->updateAnnotations(&layer, rect, renderZoom(), renderZoom());
+    }
+    if (patched)
+    {
+        m_annotationLayers.insert(page, layer);
+    }
+    else
+    {
+        m_PageRender->requestAnnotations(page, renderZoom());
+    }
+
+    const QRectF rect = pageRect(page);
+    const qreal scale = m_screenResolution * m_zoom;
+    foreach (const QRectF &area, dirty)
+    {
+        update(QRectF(rect.topLeft() + area.topLeft() * scale, area.size() * scale).toAlignedRect().adjusted(-2, -2, 2, 2));
+    }
+}
+
+void SequentialPageWidget::finishEditing()
+{
+    if (m_editField >= 0)
+    {
+        update();
+    }
+    delete m_editPage;
+    m_editPage = NULL;
+    m_editPageIndex = -1;
+    m_editField = -1;
+}
+
 void SequentialPageWidget::invalidate()
+{
+    updateLayout();
+    m_pageCache.clear();
+    m_cachedPagesLRU.clear();
+    m_compressedPages.clear();
+    m_draftPages.clear();
+    m_previewPages.clear();
+    m_annotationLayers.clear();
+    m_previewAnnotations.clear();
+    update();
+}
+
+void SequentialPageWidget::updateLayout()
 {
     QSizeF totalSize(0, m_pageSpacing);
     QSizeF size(0, 0);
@@ -153,20 +741,54 @@ void SequentialPageWidget::invalidate()
         }
     }
     totalSize += QSizeF(0.49,0.49);
+    // same rounding as paintEvent(), so page lookups match what is drawn
+    m_pageOffsets.resize(m_totalPages);
+    int y = m_pageSpacing;
+    for (int page = 0; page < m_totalPages; ++page)
+    {
+        m_pageOffsets[page] = y;
+        y += pageSize(page).toSize().height() + m_pageSpacing;
+    }
     m_totalSize = totalSize.toSize();
     setMinimumSize(m_totalSize);
-    m_pageCache.clear();
+}
+
+/**
+ * @brief The user scrolls or zooms: pages missing meanwhile are rendered
+ * as drafts with reduced anti-aliasing, and re-rendered in full quality
+ * once the view was idle for a moment.
+ */
+void SequentialPageWidget::noteInteraction()
+{
+    m_interacting = true;
+    m_idleTimer.start();
+}
+
+void SequentialPageWidget::interactionFinished()
+{
+    m_interacting = false;
+    // paintEvent() requests visible draft pages again
     update();
 }
 
+/**
+ * @brief The scroll area moves this widget when it is scrolled, by the
+ * scroll bars, the wheel or dragging the page.
+ */
+void SequentialPageWidget::moveEvent(QMoveEvent *event)
+{
+    QWidget::moveEvent(event);
+    noteInteraction();
+}
+
 int SequentialPageWidget::yForPage()
 {
-    int y = 0;
-    for (int page = 0; page < m_totalPages && page < m_pageIndex; ++page)
-    {
-        y += m_pageSpacing + pageSize(page).toSize().height();
-    }
-    return y;
+    return m_pageOffsets.value(m_pageIndex, m_pageSpacing) - m_pageSpacing;
+}
+
+MuPDF::Document *SequentialPageWidget::document() const
+{
+    return m_document;
 }
 
 QImage SequentialPageWidget::getPDFImage(int index)
@@ -181,20 +803,117 @@ QImage SequentialPageWidget::getPDFImage(int index)
 }
 
 
-void SequentialPageWidget::pageLoaded(int page, qreal zoom, QImage image)
+void SequentialPageWidget::pageLoaded(int page, qreal zoom, QImage image, bool draft, int generation)
+{
+    if (generation != m_PageRender->generation() || !qFuzzyCompare(zoom, renderZoom()))
+    {
+        // rendered for the previous document or before a zoom change
+        return;
+    }
+    if (draft && m_pageCache.contains(page) && !m_draftPages.contains(page))
+    {
+        // a full quality image came first
+        return;
+    }
+    cachePage(page, image, draft);
+    m_previewPages.remove(page);
+    update();
+}
+
+void SequentialPageWidget::annotationsLoaded(int page, qreal zoom, QImage layer, int generation)
+{
+    if (generation != m_PageRender->generation() || !qFuzzyCompare(zoom, renderZoom())
+            || (page == m_editPageIndex && m_annotationLayers.contains(page)))
+    {
+        // rendered for the previous document or before a zoom change, or
+        // older than the edits patched in
+        return;
+    }
+    layer.setDevicePixelRatio(m_devicePixelRatio);
+    m_annotationLayers.insert(page, layer);
+    m_previewAnnotations.remove(page);
+    update();
+}
+
+void SequentialPageWidget::cachePage(int page, QImage image, bool draft)
 {
-    Q_UNUSED(zoom)
+    // painting uses logical pixels
+    image.setDevicePixelRatio(m_devicePixelRatio);
+    if (draft)
+        m_draftPages.insert(page);
+    else
+        m_draftPages.remove(page);
+
+    m_cachedPagesLRU.removeOne(page);
     if (m_cachedPagesLRU.length() > m_pageCacheLimit)
     {
-        m_pageCache.remove(m_cachedPagesLRU.takeFirst());
+        evictPage();
     }
     m_pageCache.insert(page, image);
     m_cachedPagesLRU.append(page);
-    update();
+}
+
+/**
+ * @brief Drop the least recently used page, moving it to the compressed
+ * tier if @p compress.
+ *
+ * @return bytes actually freed: images still shared, e.g. with a pending
+ *         compression, stay allocated
+ */
+qint64 SequentialPageWidget::evictPage(bool compress)
+{
+    const int evicted = m_cachedPagesLRU.takeFirst();
+    QImage image = m_pageCache.take(evicted);
+    // comes back from the page cache with the page
+    QImage layer = m_annotationLayers.take(evicted);
+    qint64 freed = layer.isDetached() ? layer.sizeInBytes() : 0;
+    // drafts are not worth keeping
+    if (!m_draftPages.remove(evicted) && compress && !m_compressedPages.contains(evicted))
+        m_compressedPages.insert(evicted, image);
+    else if (image.isDetached())
+        freed += image.sizeInBytes();
+    return freed;
+}
+
+/**
+ * @brief Bytes held by uncompressed page images and annotation layers.
+ */
+qint64 SequentialPageWidget::memoryUsage() const
+{
+    qint64 usage = 0;
+    foreach (const QImage &image, m_pageCache)
+    {
+        usage += image.sizeInBytes();
+    }
+    foreach (const QImage &layer, m_annotationLayers)
+    {
+        usage += layer.sizeInBytes();
+    }
+    return usage;
+}
+
+/**
+ * @brief Drop least recently used pages; visible ones come back from the
+ * compressed tier or are rendered again at the next paint.
+ *
+ * They are not compressed here: the encoder would keep the image alive
+ * and allocate its output buffer on top, raising the peak this is meant
+ * to lower.
+ */
+qint64 SequentialPageWidget::releaseMemory(qint64 bytes)
+{
+    qint64 released = 0;
+    while (released < bytes && !m_cachedPagesLRU.isEmpty())
+    {
+        released += evictPage(false);
+    }
+    return released;
 }
 
 void SequentialPageWidget::paintEvent(QPaintEvent * event)
 {
+    TRACE_SPAN("paint", "SequentialPageWidget::paintEvent");
+    updateDevicePixelRatio();
     QPainter painter(this);
 
     if (0 == m_totalPages)
@@ -222,21 +941,82 @@ void SequentialPageWidget::paintEvent(QPaintEvent * event)
     while (y < event->rect().bottom() && page < m_totalPages)
     {
         QSizeF size = pageSize(page);
+        const QRectF target((width() - size.width()) / 2, y, size.width(), size.height());
+
+        if (!m_zooming && !m_pageCache.contains(page))
+        {
+            const QImage image = m_compressedPages.value(page);
+            if (!image.isNull())
+            {
+                TRACE_INSTANT("cache", "compressed page hit", page);
+                cachePage(page, image, false);
+            }
+        }
 
         if (m_pageCache.contains(page))
         {
+            TRACE_INSTANT("cache", "page cache hit", page);
+            if (!m_zooming && !m_interacting && m_draftPages.contains(page))
+            {
+                m_PageRender->requestPage(page, renderZoom());
+            }
             const QImage &img = m_pageCache[page];
-            painter.fillRect((width() - img.width()) / 2, y, size.width(), size.height(), Qt::white);
-            painter.drawImage((width() - img.width()) / 2, y, img);
+            painter.fillRect(target, Qt::white);
+            const QSize logicalSize = img.size() / img.devicePixelRatio();
+            if (logicalSize == size.toSize())
+                painter.drawImage((width() - logicalSize.width()) / 2, y, img);
+            else
+                painter.drawImage(target, img);
+            if (m_showAnnotations)
+            {
+                const QImage layer = m_annotationLayers.value(page, m_previewAnnotations.value(page));
+                if (layer.size() == img.size())
+                    painter.drawImage((width() - logicalSize.width()) / 2, y, layer);
+                else if (!layer.isNull())
+                    painter.drawImage(target, layer);
+                if (!m_zooming && !m_annotationLayers.contains(page))
+                {
+                    m_PageRender->requestAnnotations(page, renderZoom());
+                }
+            }
+            if (page == m_editPageIndex && m_editField >= 0)
+            {
+                const qreal scale = m_screenResolution * m_zoom;
+                painter.setPen(palette().color(QPalette::Highlight));
+                painter.drawRect(QRectF(target.topLeft() + m_editFieldRect.topLeft() * scale,
+                                        m_editFieldRect.size() * scale));
+            }
+            if (page == m_selectionPage)
+            {
+                const qreal scale = m_screenResolution * m_zoom;
+                QColor highlight = palette().color(QPalette::Highlight);
+                highlight.setAlpha(96);
+                foreach (const QRectF &rect, m_selectionRects)
+                {
+                    painter.fillRect(QRectF(target.topLeft() + rect.topLeft() * scale, rect.size() * scale), highlight);
+                }
+            }
             getPage();
             emit updatePdfInfo(m_pageIndex, m_totalPages, m_zoom);
         }
+        else if (m_previewPages.contains(page))
+        {
+            // rendered at another zoom, scale it until the page is ready
+            painter.fillRect(target, Qt::white);
+            painter.drawImage(target, m_previewPages.value(page));
+            if (m_showAnnotations && m_previewAnnotations.contains(page))
+                painter.drawImage(target, m_previewAnnotations.value(page));
+            if (!m_zooming)
+                m_PageRender->requestPage(page, renderZoom());
+        }
         else
         {
-            painter.fillRect((width() - size.width()) / 2, y, size.width(), size.height(), Qt::white);
-            painter.drawPixmap((size.width() - m_placeholderIcon.width()) / 2,
-                               (size.height() - m_placeholderIcon.height()) / 2, m_placeholderIcon);
-            m_PageRender->requestPage(page, m_screenResolution * m_zoom);
+            TRACE_INSTANT("cache", "page cache miss", page);
+            painter.fillRect(target, Qt::white);
+            painter.drawPixmap(target.center() - QPointF(m_placeholderIcon.width(), m_placeholderIcon.height()) / 2,
+                               m_placeholderIcon);
+            if (!m_zooming)
+                m_PageRender->requestPage(page, renderZoom(), m_interacting);
         }
         y += size.height() + m_pageSpacing;
         ++page;
@@ -1,13 +1,17 @@
 #ifndef SEQUENTIALPAGEWIDGET_H
 #define SEQUENTIALPAGEWIDGET_H
 
+#include <QSet>
+#include <QTimer>
 #include <QWidget>
+#include "compressedimagecache.h"
+#include "memorygovernor.h"
 #include "mupdfdocument.h"
 #include "mupdfpage.h"
 
 class PageRender;
 
-class SequentialPageWidget : public QWidget
+class SequentialPageWidget : public QWidget, public MemoryConsumer
 {
     Q_OBJECT
 public:
@@ -20,9 +24,19 @@ public:
     int yForPage();
 
     QImage getPDFImage(int index);
+    MuPDF::Document *document() const;
+    PageRender *pageRender() const;
+    MuPDF::ColorEffect colorEffect() const;
+    qreal zoom() const;
+    bool showAnnotations() const;
+
+    qint64 memoryUsage() const;
+    qint64 releaseMemory(qint64 bytes);
 
 signals:
     void updatePdfInfo(int pageIndex, int totalPages, qreal zoom);
+    // a link was followed, scroll the view to @p y
+    void scrollRequested(int y);
 
 public slots:
     void nextPage();
@@ -30,19 +44,68 @@ public slots:
     void goToPage(int page);
     void zoomIn();
     void zoomOut();
+    void setZoom(qreal zoom);
+    void setColorEffect(MuPDF::ColorEffect effect);
+    void setShowAnnotations(bool show);
+    void reloadAnnotations(int page);
+
+protected:
+    bool event(QEvent *event);
+    void moveEvent(QMoveEvent *event);
+    void wheelEvent(QWheelEvent *event);
+    void mousePressEvent(QMouseEvent *event);
+    void mouseMoveEvent(QMouseEvent *event);
+    void mouseReleaseEvent(QMouseEvent *event);
+    void mouseDoubleClickEvent(QMouseEvent *event);
+    void keyPressEvent(QKeyEvent *event);
+    void focusOutEvent(QFocusEvent *event);
 
 private slots:
-    void pageLoaded(int page, qreal zoom, QImage image);
+    void pageLoaded(int page, qreal zoom, QImage image, bool draft, int generation);
+    void annotationsLoaded(int page, qreal zoom, QImage layer, int generation);
+    void interactionFinished();
+    void zoomSettled();
 
 private:
     void invalidate();
+    void updateLayout();
+    void keepPreviews();
+    qreal renderZoom() const;
+    void updateDevicePixelRatio();
+    void noteInteraction();
+    void cachePage(int page, QImage image, bool draft);
+    qint64 evictPage(bool compress = true);
     QSizeF pageSize(int page);
+    QRectF pageRect(int page);
+    int pageAt(const QPoint &pos, QPointF *point);
+    MuPDF::Page *geometryPage(int page);
+    void clearGeometryPages();
+    void clearSelection();
+    void followLink(const MuPDF::Link &link);
+    void editTextField();
+    void finishEditing();
 
 private:
     QHash<int, QImage> m_pageCache;
     QVector<int> m_cachedPagesLRU;
     int m_pageCacheLimit;
+    // pages evicted from m_pageCache, kept compressed
+    CompressedImageCache m_compressedPages;
+    // cached pages rendered with draft quality, see noteInteraction()
+    QSet<int> m_draftPages;
+    bool m_interacting;
+    QTimer m_idleTimer;
+    // pages at the previous zoom, drawn scaled until rendered again
+    QHash<int, QImage> m_previewPages;
+    // annotation layers drawn over the pages, null if a page has none
+    QHash<int, QImage> m_annotationLayers;
+    QHash<int, QImage> m_previewAnnotations;
+    bool m_showAnnotations;
+    bool m_zooming;
+    QTimer m_zoomTimer;
     QVector<QSizeF> m_pageSizes;
+    // top of each page at the current zoom, see updateLayout()
+    QVector<int> m_pageOffsets;
     PageRender *m_PageRender;
 
     int m_pageSpacing;
@@ -51,7 +114,26 @@ private:
     QSize m_totalSize;
     qreal m_zoom;
     qreal m_screenResolution;
+    qreal m_devicePixelRatio;   // of the screen the window is on
+    MuPDF::ColorEffect m_colorEffect;
     QPixmap m_placeholderIcon;
+    // text form field being typed into, see mouseDoubleClickEvent()
+    MuPDF::Page *m_editPage;
+    int m_editPageIndex;
+    int m_editField;
+    QRectF m_editFieldRect;     // in points
+    QString m_editText;
+    // pages used for hit testing, links and text selection, see geometryPage()
+    QHash<int, MuPDF::Page *> m_geometryPages;
+    QVector<int> m_geometryPagesLRU;
+    int m_pressedLink;          // link under the mouse press, on m_pressedLinkPage
+    int m_pressedLinkPage;
+    // text selected with Shift+drag, corners in points
+    int m_selectionPage;
+    bool m_selecting;
+    QPointF m_selectionStart;
+    QPointF m_selectionEnd;
+    QVector<QRectF> m_selectionRects;
 
     MuPDF::Document *m_document;
 };
@@ -0,0 +1,219 @@
+#include "thumbnailview.h"
+#include "pagerender.h"
+#include <QColor>
+
+ThumbnailModel::ThumbnailModel(QObject *parent)
+    : QAbstractListModel(parent)
+    , m_render(NULL)
+    , m_pageCount(0)
+    , m_devicePixelRatio(1.0)
+    , m_cache(8 * 1024)
+{
+    setThumbnailSize(QSize(120, 160));
+    MemoryGovernor::instance()->addConsumer(this, MemoryGovernor::Thumbnails);
+}
+
+ThumbnailModel::~ThumbnailModel()
+{
+    MemoryGovernor::instance()->removeConsumer(this);
+}
+
+void ThumbnailModel::setPageRender(PageRender *render)
+{
+    if (m_render)
+    {
+        disconnect(m_render, SIGNAL(thumbnailReady(int, QSize, QImage, int)), this, SLOT(thumbnailLoaded(int, QSize, QImage, int)));
+    }
+    m_render = render;
+    if (m_render)
+    {
+        connect(m_render, SIGNAL(thumbnailReady(int, QSize, QImage, int)), this, SLOT(thumbnailLoaded(int, QSize, QImage, int)), Qt::QueuedConnection);
+    }
+}
+
+/**
+ * @brief Show the pages of a newly opened document.
+ */
+void ThumbnailModel::setPageCount(int count)
+{
+    beginResetModel();
+    m_pageCount = qMax(0, count);
+    m_cache.clear();
+    endResetModel();
+}
+
+void ThumbnailModel::setThumbnailSize(const QSize &size)
+{
+    beginResetModel();
+    m_thumbnailSize = size;
+    m_cache.clear();
+    m_placeholder = QPixmap(size);
+    m_placeholder.fill(QColor(0xe8, 0xe8, 0xe8));
+    endResetModel();
+}
+
+QSize ThumbnailModel::thumbnailSize() const
+{
+    return m_thumbnailSize;
+}
+
+/**
+ * @brief Render thumbnails for a screen with @p ratio physical pixels per
+ * logical pixel; thumbnailSize() stays in logical pixels.
+ */
+void ThumbnailModel::setDevicePixelRatio(qreal ratio)
+{
+    if (qFuzzyCompare(ratio, m_devicePixelRatio))
+    {
+        return;
+    }
+    m_devicePixelRatio = ratio;
+    invalidate();
+}
+
+/**
+ * @brief Drop all thumbnails and render the visible ones again, e.g.
+ * after the color effect of the document changed.
+ */
+void ThumbnailModel::invalidate()
+{
+    m_cache.clear();
+    if (m_pageCount > 0)
+    {
+        emit dataChanged(index(0), index(m_pageCount - 1), QVector<int>() << Qt::DecorationRole);
+    }
+}
+
+/**
+ * @brief Memory for finished thumbnails (default 8 MiB).
+ */
+void ThumbnailModel::setCacheBudget(int bytes)
+{
+    m_cache.setMaxCost(qMax(1, bytes / 1024));
+}
+
+qint64 ThumbnailModel::memoryUsage() const
+{
+    return qint64(m_cache.totalCost()) * 1024;
+}
+
+/**
+ * @brief Drop least recently shown thumbnails; they come back from the
+ * disk cache when their rows are shown again.
+ */
+qint64 ThumbnailModel::releaseMemory(qint64 bytes)
+{
+    const int before = m_cache.totalCost();
+    const int maxCost = m_cache.maxCost();
+    // QCache trims least recently used objects to a lower cap
+    m_cache.setMaxCost(int(qMax(Q_INT64_C(0), before - bytes / 1024)));
+    m_cache.setMaxCost(maxCost);
+    return qint64(before - m_cache.totalCost()) * 1024;
+}
+
+int ThumbnailModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_pageCount;
+}
+
+QVariant ThumbnailModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_pageCount)
+    {
+        return QVariant();
+    }
+
+    const int page = index.row();
+    switch (role)
+    {
+    case Qt::DisplayRole:
+        return QString::number(page + 1);
+    case Qt::DecorationRole:
+        if (QPixmap *pixmap = m_cache.object(page))
+        {
+            return *pixmap;
+        }
+        // asked for by the view, so the row is visible
+        if (m_render)
+        {
+            m_render->requestThumbnail(page, m_thumbnailSize * m_devicePixelRatio);
+        }
+        return m_placeholder;
+    case Qt::SizeHintRole:
+        return QSize(m_thumbnailSize.width(), m_thumbnailSize.height() + 20);
+    case Qt::TextAlignmentRole:
+        return int(Qt::AlignHCenter | Qt::AlignTop);
+    default:
+        return QVariant();
+    }
+}
+
+void ThumbnailModel::thumbnailLoaded(int page, QSize size, QImage image, int generation)
+{
+    // rendered for the previous document, or another size
+    if (!m_render || generation != m_render->generation()
+            || page >= m_pageCount || size != m_thumbnailSize * m_devicePixelRatio)
+    {
+        return;
+    }
+    QPixmap *pixmap = new QPixmap(QPixmap::fromImage(image));
+    pixmap->setDevicePixelRatio(m_devicePixelRatio);
+    const int cost = qMax(1, pixmap->width() * pixmap->height() * pixmap->depth() / 8 / 1024);
+    m_cache.insert(page, pixmap, cost);
+    const QModelIndex changed = index(page);
+    emit dataChanged(changed, changed, QVector<int>() << Qt::DecorationRole);
+}
+
+ThumbnailView::ThumbnailView(QWidget *parent)
+    : QListView(parent)
+    , m_model(new ThumbnailModel(this))
+{
+    setModel(m_model);
+    // uniform rows let the view skip measuring off-screen items
+    setUniformItemSizes(true);
+    setViewMode(QListView::IconMode);
+    setFlow(QListView::TopToBottom);
+    setWrapping(false);
+    setMovement(QListView::Static);
+    setResizeMode(QListView::Adjust);
+    setSelectionMode(QAbstractItemView::SingleSelection);
+    setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
+    setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setIconSize(m_model->thumbnailSize());
+    setSpacing(6);
+    connect(this, SIGNAL(clicked(QModelIndex)), this, SLOT(itemClicked(QModelIndex)));
+}
+
+ThumbnailModel *ThumbnailView::thumbnailModel() const
+{
+    return m_model;
+}
+
+/**
+ * @brief Highlight the page shown in the main view.
+ */
+void ThumbnailView::setCurrentPage(int page)
+{
+    if (page < 0 || page >= m_model->rowCount() || currentIndex().row() == page)
+    {
+        return;
+    }
+    const QModelIndex index = m_model->index(page);
+    setCurrentIndex(index);
+    scrollTo(index, QAbstractItemView::EnsureVisible);
+}
+
+void ThumbnailView::paintEvent(QPaintEvent *event)
+{
+    // the window may have moved to another screen
+    m_model->setDevicePixelRatio(viewport()->devicePixelRatioF());
+    QListView::paintEvent(event);
+}
+
+void ThumbnailView::itemClicked(const QModelIndex &index)
+{
+    if (index.isValid())
+    {
+        emit pageActivated(index.row());
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef THUMBNAILVIEW_H
+#define THUMBNAILVIEW_H
+
+#include <QAbstractListModel>
+#include <QCache>
+#include <QImage>
+#include <QListView>
+#include <QPixmap>
+#include <QSize>
+#include "memorygovernor.h"
+
+class PageRender;
+
+/**
+ * @brief One row per page; thumbnails are requested from the render
+ * scheduler only when a view asks for them, i.e. for visible rows.
+ *
+ * Finished thumbnails live in a cache with its own byte budget,
+ * independent from the page cache of the main view.
+ */
+class ThumbnailModel : public QAbstractListModel, public MemoryConsumer
+{
+    Q_OBJECT
+
+public:
+    explicit ThumbnailModel(QObject *parent = NULL);
+    ~ThumbnailModel();
+
+    void setPageRender(PageRender *render);
+    void setPageCount(int count);
+    void setThumbnailSize(const QSize &size);
+    QSize thumbnailSize() const;
+    void setDevicePixelRatio(qreal ratio);
+    void setCacheBudget(int bytes);
+    void invalidate();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+
+    qint64 memoryUsage() const;
+    qint64 releaseMemory(qint64 bytes);
+
+private slots:
+    void thumbnailLoaded(int page, QSize size, QImage image, int generation);
+
+private:
+    PageRender *m_render;
+    int m_pageCount;
+    QSize m_thumbnailSize;
+    qreal m_devicePixelRatio;
+    QCache<int, QPixmap> m_cache;   // cost in KiB
+    QPixmap m_placeholder;
+};
+
+/**
+ * @brief Vertical thumbnail strip. Only visible rows are materialized.
+ */
+class ThumbnailView : public QListView
+{
+    Q_OBJECT
+
+public:
+    explicit ThumbnailView(QWidget *parent = 0);
+
+    ThumbnailModel *thumbnailModel() const;
+
+signals:
+    void pageActivated(int page);
+
+public slots:
+    void setCurrentPage(int page);
+
+protected:
+    void paintEvent(QPaintEvent *event);
+
+private slots:
+    void itemClicked(const QModelIndex &index);
+
+private:
+    ThumbnailModel *m_model;
+};
+
+#endif // THUMBNAILVIEW_H
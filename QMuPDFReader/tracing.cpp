@@ -0,0 +1,272 @@
+#include "tracing.h"
+
+#include <QAtomicInteger>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QString>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+
+namespace
+{
+
+const quint32 eventsPerThread = 8192;
+
+/**
+ * @brief One recorded event. end < 0 marks an instant event.
+ */
+struct Event
+{
+    const char *category;
+    const char *name;
+    qint64 begin;
+    qint64 end;
+    qint64 value;
+    int tid;
+};
+
+/**
+ * @brief Ring buffer written by exactly one thread at a time.
+ *
+ * The writer publishes every event with a release store of head, the
+ * reader only looks at slots below an acquired head. A dump racing with
+ * a busy writer may see a handful of overwritten slots, which is fine
+ * for diagnostics.
+ */
+struct ThreadBuffer
+{
+    ThreadBuffer()
+        : tid(0)
+        , head(0)
+    {
+    }
+
+    int tid;
+    QAtomicInteger<quint32> head;
+    Event events[eventsPerThread];
+};
+
+/**
+ * @brief Owns all buffers. Buffers of finished threads are recycled,
+ * so a QThread that is restarted for every job does not grow the trace.
+ */
+class Registry
+{
+public:
+    Registry()
+        : nextTid(0)
+    {
+        timer.start();
+    }
+
+    ThreadBuffer *acquire()
+    {
+        QMutexLocker locker(&mutex);
+        ThreadBuffer *buffer;
+        if (spare.isEmpty())
+        {
+            buffer = new ThreadBuffer;
+            buffers << buffer;
+        }
+        else
+        {
+            buffer = spare.takeLast();
+        }
+        buffer->tid = ++nextTid;
+        threadNames.insert(buffer->tid, currentThreadName());
+        return buffer;
+    }
+
+    void release(ThreadBuffer *buffer)
+    {
+        QMutexLocker locker(&mutex);
+        spare << buffer;
+    }
+
+    static QString currentThreadName()
+    {
+        QThread *thread = QThread::currentThread();
+        if (QCoreApplication::instance() && thread == QCoreApplication::instance()->thread())
+            return QStringLiteral("main");
+        if (!thread->objectName().isEmpty())
+            return thread->objectName();
+        return QString::fromLatin1(thread->metaObject()->className());
+    }
+
+    QElapsedTimer timer;
+    QMutex mutex;
+    QList<ThreadBuffer *> buffers;
+    QList<ThreadBuffer *> spare;
+    QHash<int, QString> threadNames;
+    int nextTid;
+};
+
+Registry &registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+/**
+ * @brief Hands the calling thread its buffer and gives it back on exit.
+ */
+class ThreadBufferHandle
+{
+public:
+    ThreadBufferHandle()
+        : buffer(registry().acquire())
+    {
+    }
+
+    ~ThreadBufferHandle()
+    {
+        registry().release(buffer);
+    }
+
+    ThreadBuffer *buffer;
+};
+
+inline void record(const char *category, const char *name, qint64 begin, qint64 end, qint64 value)
+{
+    static thread_local ThreadBufferHandle handle;
+    ThreadBuffer *buffer = handle.buffer;
+    quint32 head = buffer->head.load();
+    Event &event = buffer->events[head % eventsPerThread];
+    event.category = category;
+    event.name = name;
+    event.begin = begin;
+    event.end = end;
+    event.value = value;
+    event.tid = buffer->tid;
+    buffer->head.storeRelease(head + 1);
+}
+
+QString escaped(const char *text)
+{
+    QString str = QString::fromUtf8(text);
+    str.replace('\\', "\\\\");
+    str.replace('"', "\\\"");
+    return str;
+}
+
+} // end anonymous namespace
+
+namespace Tracing
+{
+
+// constant initialized, valid before any static constructor runs
+QAtomicInt recording(0);
+
+/**
+ * @brief Start or stop recording. Already recorded events are kept.
+ */
+void setEnabled(bool enable)
+{
+    // start the clock before the first span reads it
+    registry();
+    recording.store(enable ? 1 : 0);
+}
+
+/**
+ * @brief Monotonic timestamp in nanoseconds, as used by recordSpan().
+ */
+qint64 now()
+{
+    return registry().timer.nsecsElapsed();
+}
+
+/**
+ * @brief Record a span with explicit timestamps from now().
+ * Use this for intervals that do not match a scope, such as the time a
+ * request spent queued before a worker picked it up.
+ */
+void recordSpan(const char *category, const char *name, qint64 begin, qint64 end)
+{
+    if (isEnabled())
+        record(category, name, begin, end, -1);
+}
+
+/**
+ * @brief Record a point in time, for example a cache hit.
+ *
+ * @param value optional value shown as the event argument (-1: none)
+ */
+void recordInstant(const char *category, const char *name, qint64 value)
+{
+    if (isEnabled())
+        record(category, name, now(), -1, value);
+}
+
+/**
+ * @brief Write everything recorded so far as Chrome trace_event JSON.
+ *
+ * @return false if the file cannot be written.
+ */
+bool dump(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return false;
+
+    Registry &reg = registry();
+    QList<ThreadBuffer *> buffers;
+    QHash<int, QString> threadNames;
+    {
+        QMutexLocker locker(&reg.mutex);
+        buffers = reg.buffers;
+        threadNames = reg.threadNames;
+    }
+
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+
+    QHash<int, QString>::const_iterator it;
+    for (it = threadNames.constBegin(); it != threadNames.constEnd(); ++it)
+    {
+        out << (first ? "" : ",\n")
+            << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << it.key()
+            << ",\"args\":{\"name\":\"" << escaped(it.value().toUtf8()) << "\"}}";
+        first = false;
+    }
+
+    foreach (ThreadBuffer *buffer, buffers)
+    {
+        quint32 head = buffer->head.loadAcquire();
+        quint32 count = qMin(head, eventsPerThread);
+        for (quint32 i = head - count; i != head; ++i)
+        {
+            const Event event = buffer->events[i % eventsPerThread];
+            out << (first ? "" : ",\n")
+                << "{\"cat\":\"" << escaped(event.category)
+                << "\",\"name\":\"" << escaped(event.name)
+                << "\",\"pid\":1,\"tid\":" << event.tid
+                << ",\"ts\":" << QString::number(event.begin / 1000.0, 'f', 3);
+            if (event.end >= 0)
+            {
+                out << ",\"ph\":\"X\",\"dur\":" << QString::number((event.end - event.begin) / 1000.0, 'f', 3);
+            }
+            else
+            {
+                out << ",\"ph\":\"i\",\"s\":\"t\"";
+            }
+            if (event.value >= 0)
+            {
+                out << ",\"args\":{\"value\":" << event.value << "}";
+            }
+            out << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    return out.status() == QTextStream::Ok;
+}
+
+} // end namespace Tracing
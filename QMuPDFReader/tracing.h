@@ -0,0 +1,93 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <QAtomicInt>
+#include <QtGlobal>
+
+class QString;
+
+/**
+ * @brief Lightweight trace spans, exported as Chrome trace_event JSON.
+ *
+ * Build with QMUPDF_TRACING defined to compile the TRACE_* macros in;
+ * without it they expand to nothing. Even when compiled in, recording
+ * is off until Tracing::setEnabled(true) is called, and a disabled span
+ * costs one relaxed atomic load.
+ *
+ * Every thread writes into its own fixed-size ring buffer without
+ * locking; once a buffer is full the oldest events are overwritten.
+ * Load the file written by Tracing::dump() in chrome://tracing or
+ * https://ui.perfetto.dev.
+ *
+ * @note Names and categories must be string literals (or otherwise
+ * outlive the trace), only the pointers are recorded.
+ */
+namespace Tracing
+{
+
+// set by setEnabled(); a plain global, so checking it needs no call and
+// no static initialization guard
+extern QAtomicInt recording;
+
+inline bool isEnabled()
+{
+    return recording.load() != 0;
+}
+
+void setEnabled(bool enable);
+
+qint64 now();
+void recordSpan(const char *category, const char *name, qint64 begin, qint64 end);
+void recordInstant(const char *category, const char *name, qint64 value = -1);
+
+bool dump(const QString &filePath);
+
+/**
+ * @brief Record the lifetime of this object as a span.
+ */
+class Span
+{
+public:
+    Span(const char *category, const char *name)
+        : m_category(category)
+        , m_name(name)
+        , m_begin(isEnabled() ? now() : -1)
+    {
+    }
+
+    ~Span()
+    {
+        if (m_begin >= 0)
+            recordSpan(m_category, m_name, m_begin, now());
+    }
+
+private:
+    Span(const Span &);
+    Span &operator=(const Span &);
+
+    const char *m_category;
+    const char *m_name;
+    qint64 m_begin;
+};
+
+} // end namespace Tracing
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#ifdef QMUPDF_TRACING
+#define TRACE_SPAN(category, name) \
+    Tracing::Span TRACE_CONCAT(traceSpan_, __LINE__)(category, name)
+#define TRACE_INSTANT(category, name, value) \
+    do { if (Tracing::isEnabled()) Tracing::recordInstant(category, name, value); } while (0)
+#define TRACE_TIMESTAMP() (Tracing::isEnabled() ? Tracing::now() : -1)
+#define TRACE_SPAN_SINCE(category, name, begin) \
+    do { if ((begin) >= 0 && Tracing::isEnabled()) Tracing::recordSpan(category, name, begin, Tracing::now()); } while (0)
+#else
+#define TRACE_SPAN(category, name) do { } while (0)
+#define TRACE_INSTANT(category, name, value) do { } while (0)
+#define TRACE_TIMESTAMP() (-1)
+#define TRACE_SPAN_SINCE(category, name, begin) do { (void)(begin); } while (0)
+#endif
+
+#endif // TRACING_H
@@ -0,0 +1,155 @@
+#include "wordwriter.h"
+
+#include <QDataStream>
+#include <QIODevice>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+
+WordWriter::WordWriter(QIODevice *device)
+    : m_device(device)
+{
+}
+
+/**
+ * @brief Why the stream stopped, empty if it did not.
+ */
+QString WordWriter::errorString() const
+{
+    return m_error;
+}
+
+/**
+ * @brief The words of @p page, remembering @p index as failed if the
+ * page is NULL or its text could not be extracted. Thread safe.
+ */
+QVector<MuPDF::Word> WordWriter::pageWords(int index, const MuPDF::Page *page)
+{
+    bool ok = false;
+    const QVector<MuPDF::Word> words = page ? page->words(&ok) : QVector<MuPDF::Word>();
+    if (!ok)
+    {
+        QMutexLocker locker(&m_failedMutex);
+        m_failedPages.insert(index);
+    }
+    return words;
+}
+
+/**
+ * @brief Write the encoded page, or stop if it failed in pageWords().
+ */
+bool WordWriter::write(int index, const QByteArray &data)
+{
+    if (!m_error.isEmpty())
+    {
+        return false;
+    }
+    {
+        QMutexLocker locker(&m_failedMutex);
+        if (m_failedPages.contains(index))
+        {
+            m_error = QString("cannot extract the words of page %1").arg(index + 1);
+            return false;
+        }
+    }
+    if (m_device->write(data) != data.size())
+    {
+        m_error = m_device->errorString();
+        return false;
+    }
+    return true;
+}
+
+JsonLinesWordWriter::JsonLinesWordWriter(QIODevice *device)
+    : WordWriter(device)
+{
+}
+
+QByteArray JsonLinesWordWriter::encodePage(int index, const MuPDF::Page *page)
+{
+    QByteArray data;
+    const QVector<MuPDF::Word> words = pageWords(index, page);
+    for (int i = 0; i < words.size(); ++i)
+    {
+        const MuPDF::Word &word = words.at(i);
+        QJsonArray bbox;
+        bbox << word.bbox.left() << word.bbox.top() << word.bbox.right() << word.bbox.bottom();
+        QJsonObject object;
+        object.insert("page", index);
+        object.insert("word", i);
+        object.insert("text", word.text);
+        object.insert("bbox", bbox);
+        object.insert("size", word.fontSize);
+        object.insert("block", word.block);
+        object.insert("line", word.line);
+        data += QJsonDocument(object).toJson(QJsonDocument::Compact);
+        data += '\n';
+    }
+    return data;
+}
+
+bool JsonLinesWordWriter::writePage(int index, const QByteArray &data)
+{
+    return write(index, data);
+}
+
+/**
+ * @brief Writes the file header right away; if that fails the first
+ * writePage() stops the stream with errorString() set.
+ */
+ColumnarWordWriter::ColumnarWordWriter(QIODevice *device)
+    : WordWriter(device)
+{
+    QByteArray header("MWRD");
+    QDataStream stream(&header, QIODevice::Append);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream << quint32(1);
+    if (m_device->write(header) != header.size())
+    {
+        m_error = m_device->errorString();
+    }
+}
+
+QByteArray ColumnarWordWriter::encodePage(int index, const MuPDF::Page *page)
+{
+    const QVector<MuPDF::Word> words = pageWords(index, page);
+    QByteArray text;
+    QVector<quint32> textEnd;
+    textEnd.reserve(words.size());
+    foreach (const MuPDF::Word &word, words)
+    {
+        text += word.text.toUtf8();
+        textEnd.append(quint32(text.size()));
+    }
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    stream << quint32(index) << quint32(words.size());
+    foreach (const MuPDF::Word &word, words)
+        stream << float(word.bbox.left());
+    foreach (const MuPDF::Word &word, words)
+        stream << float(word.bbox.top());
+    foreach (const MuPDF::Word &word, words)
+        stream << float(word.bbox.right());
+    foreach (const MuPDF::Word &word, words)
+        stream << float(word.bbox.bottom());
+    foreach (const MuPDF::Word &word, words)
+        stream << word.fontSize;
+    foreach (const MuPDF::Word &word, words)
+        stream << quint32(word.block);
+    foreach (const MuPDF::Word &word, words)
+        stream << quint32(word.line);
+    foreach (quint32 end, textEnd)
+        stream << end;
+    stream << quint32(text.size());
+    stream.writeRawData(text.constData(), text.size());
+    return data;
+}
+
+bool ColumnarWordWriter::writePage(int index, const QByteArray &data)
+{
+    return write(index, data);
+}
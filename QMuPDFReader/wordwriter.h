@@ -0,0 +1,78 @@
+#ifndef WORDWRITER_H
+#define WORDWRITER_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include "mupdfdocument.h"
+#include "mupdfpage.h"
+
+class QIODevice;
+
+/**
+ * @brief Common part of the word writers: extracts the words of a page
+ * and stops the stream at the first page that could not be loaded or
+ * extracted, rather than leave it out of the file.
+ */
+class WordWriter : public MuPDF::PageSink
+{
+public:
+    explicit WordWriter(QIODevice *device);
+
+    QString errorString() const;
+
+protected:
+    QVector<MuPDF::Word> pageWords(int index, const MuPDF::Page *page);
+    bool write(int index, const QByteArray &data);
+
+    QIODevice *m_device;
+    QString m_error;
+
+private:
+    QMutex m_failedMutex;
+    QSet<int> m_failedPages;    // pages that could not be loaded or extracted
+};
+
+/**
+ * @brief Writes the words of every page as JSON Lines, one object per
+ * word in reading order:
+ *
+ *     {"page":0,"word":0,"text":"Hello","bbox":[x0,y0,x1,y1],"size":12,"block":0,"line":0}
+ *
+ * Use it with MuPDF::Document::streamPages().
+ */
+class JsonLinesWordWriter : public WordWriter
+{
+public:
+    explicit JsonLinesWordWriter(QIODevice *device);
+
+    QByteArray encodePage(int index, const MuPDF::Page *page);
+    bool writePage(int index, const QByteArray &data);
+};
+
+/**
+ * @brief Writes the words of every page in a little endian columnar
+ * binary format, compact and cheap to load into data frames.
+ *
+ * The file starts with the magic "MWRD" and a uint32 version (1), written
+ * by the constructor so even a document without pages gives a valid
+ * file, then one chunk per page:
+ *
+ *     uint32  page index
+ *     uint32  word count n
+ *     float32 x0[n], y0[n], x1[n], y1[n], size[n]     (points)
+ *     uint32  block[n], line[n]
+ *     uint32  text end offset[n] into the UTF-8 text that follows
+ *     uint32  text bytes, then the UTF-8 text of all words
+ */
+class ColumnarWordWriter : public WordWriter
+{
+public:
+    explicit ColumnarWordWriter(QIODevice *device);
+
+    QByteArray encodePage(int index, const MuPDF::Page *page);
+    bool writePage(int index, const QByteArray &data);
+};
+
+#endif // WORDWRITER_H